@@ -7,6 +7,7 @@ purpose:    Control the LEDs of the panel with the buttons that operate the locl
 
 ******************************************************************************************************/
 #include <Arduino.h>
+#include <AP_RS485_Lift.h>         // For the LED actions
 #include "LEDs.h"
 
 
@@ -71,6 +72,40 @@ void Led_series::flashFast(const uint8_t ledNumber) {
 }
 
 
+// Performs the action of a BUTTON_LED command. Numbers of LEDs we do not have are ignored
+void Led_series::set(const uint8_t ledNumber, const uint8_t action) {
+  if (ledNumber >= myLedCnt) return;
+  switch (action) {             
+    case LED_OFF:           
+      turn_off(ledNumber);
+      break;
+    case LED_ON: 
+      turn_on(ledNumber);
+      break;
+    case SINGLE_FLASH: 
+      flash(ledNumber);
+      break;
+    case FLASH_SLOW: 
+      flashSlow(ledNumber);
+      break;
+    case FLASH_FAST: 
+      flashFast(ledNumber);
+      break;      
+    case DELAYED_OFF:    // ON, and after some delay OFF
+      flash(ledNumber, 20);
+      break;
+  }
+}
+
+
+// All LEDs are modified at once, thus before the next call of update()
+void Led_series::setState(const uint16_t state) {
+  for (uint8_t i = 0; i < myLedCnt; i++) {
+    if (state & (1 << i)) turn_on(i);
+      else turn_off(i);
+  }
+}
+
 
 void Led_series::update() {
   for (int i = 0; i < myLedCnt; i++)  {
@@ -40,6 +40,9 @@ class Led_series {
     void flash(const uint8_t ledNumber, uint8_t ticks = 5);        // Single Flash
     void flashSlow(const uint8_t ledNumber);    // Continuous series of slow flashes
     void flashFast(const uint8_t ledNumber);    // Continuous series of fast flashes
+    // Methods for the RS485 LED commands
+    void set(const uint8_t ledNumber, const uint8_t action);   // LED_OFF, LED_ON, SINGLE_FLASH, ...
+    void setState(const uint16_t state);        // Switches the LEDs in the bitmap on, all others off
 
 //================================================================================
   private:
@@ -5,8 +5,9 @@ History:   2021/04/24 AP Version 1.0
            2024/01/12 AP V1.1: mySettings added / Tested on THT board.
 
 Purpose:   Sketch for the panel with buttons that operate the loclift
-           Whenever a button is pushed, the sketch sends a RS485 message to the master controller,
-           indicating the kind of push-action performed (pressed, short-press, long-press or released).
+           Every RS485 message from the master controller is answered with the state of all buttons
+           (which are pressed), preceded by the new short-press and long-press events, if any, and
+           the time since the buttons last changed.
            It listens to commands from the master controller before making changes to the LED's status.
            What exactly happens after a button is pushed, is not decided in this script, but 
            determined by the master controller.
@@ -20,17 +21,22 @@ Purpose:   Sketch for the panel with buttons that operate the loclift
 // - THT board: https://github.com/aikopras/Lift_Vitrine/blob/main/extras/Board-THT/Compile.md
 //
 // LEDs:
-// - Blue:Indicates reception of RS485 message from the main decoder board  Should blink 10x per second.
+// - Blue:Indicates reception of RS485 message from the main decoder board. Toggles for every message.
 // - Green: The green LED indicates the board has started
 // - Yellow: The yellow LED is set immeditely after a button is pressed and switched off after
 //   a RS485 message is received that says LEDs should be turned off
 // - Red: Not used.
 // ****************************************************************************************************** 
 #include <AP_RS485_Lift.h> 
+#include <AP_RS485_Lift_Ext.h>     // For the LED state frame, records and the second panel address
 #include "hardware.h" 
 
-// Instantiate the myRS485 object
-RS485_Lift myRS485(BUTTONS_ADDR);
+// Instantiate the myRS485 object. A second panel uses its own address (see mySettings.h)
+#if defined(SECOND_PANEL)
+  RS485_Lift myRS485(BUTTONS_ADDR_2);
+#else
+  RS485_Lift myRS485(BUTTONS_ADDR);
+#endif
 
 // Declaration of everything that belongs to the LEDS
 #include "LEDs.h"
@@ -46,6 +52,10 @@ Led_series MyLeds(LedPinNr, numberOfLeds);
 const byte buttonPinNr []  = { 49, 48, 47, 46, 45, 44, 43, 42, 37, 36, 35, 34, 33, 32 };
 const byte numberOfButtons = sizeof(buttonPinNr);
 MoToButtons myButtons(buttonPinNr, numberOfButtons, 50, 3000 );
+byte sequence = 0;                    // Sequence number of the last reply
+uint16_t lastState = 0;               // The buttons that were pressed at the previous check
+unsigned long changeTime;             // Time (millis) the pressed buttons last changed
+bool changeSeen = false;              // The pressed buttons changed since start-up
 
 
 void setup() {
@@ -70,58 +80,56 @@ void toggleLed (byte nummer) {
 }
 
 
+byte age() {
+  // Time (ms) since the pressed buttons last changed, for the REC_AGE record (see AP_RS485_Lift_Ext.h)
+  unsigned long time = millis() - changeTime;
+  if (!changeSeen || (time >= AGE_UNKNOWN)) return AGE_UNKNOWN;
+  return time;
+}
+
+
 // ***********************************************************************************************************
 void loop() {
-  // The loop is only activated after we receive a message from the master controller
-  // Every 50ms we should receive a POLL message. 
+  // The buttons are checked continuously, to know when they changed. The events remain stored in the
+  // myButtons object, until they are read after a message from the master controller is received.
+  myButtons.processButtons();
+  uint16_t state = myButtons.allStates();
+  if (state != lastState) {
+    lastState = state;
+    changeTime = millis();
+    changeSeen = true;
+  }
+  // The master sends the next POLL (or LED command) as soon as the previous one was answered.
   if (myRS485.input()) { 
     toggleLed(LED_BLUE);
     // Step 1: Check if we need to change a LED
+    // A LED number of LED_STATE or higher holds the state of all LEDs (see AP_RS485_Lift_Ext.h)
     if (myRS485.command == BUTTON_LED) {
-      byte ledNumber = myRS485.value;
-      // Check the required action
-      switch (myRS485.action) {             
-      case LED_OFF:           
-        MyLeds.turn_off(ledNumber);
-        digitalWrite(LED_YELLOW, LOW);
-        break;
-      case LED_ON: 
-        MyLeds.turn_on(ledNumber);
-        break;
-      case SINGLE_FLASH: 
-        MyLeds.flash(ledNumber);
-        break;
-      case FLASH_SLOW: 
-        MyLeds.flashSlow(ledNumber);
-        digitalWrite(LED_YELLOW, HIGH);
-        break;
-      case FLASH_FAST: 
-        MyLeds.flashFast(ledNumber);
-        break;      
-      case DELAYED_OFF:    // ON, and after some delay OFF
-        MyLeds.flash(ledNumber, 20);
+      if (myRS485.value >= LED_STATE) {
+        MyLeds.setState(((myRS485.value & 0x3F) << 8) | myRS485.action);
         digitalWrite(LED_YELLOW, LOW);
-        break;
-      }      
+      }
+      else {
+        MyLeds.set(myRS485.value, myRS485.action);
+        if ((myRS485.action == LED_OFF) || (myRS485.action == DELAYED_OFF)) digitalWrite(LED_YELLOW, LOW);
+        if (myRS485.action == FLASH_SLOW) digitalWrite(LED_YELLOW, HIGH);
+      }
     }
-    // Step 2: Read the status of all buttons, and respond in case of a button action 
-    myButtons.processButtons();
-    // Analyse each individual button
+    // Step 2: Read the status of all buttons, and reply with the events and the pressed buttons
+    // PRESSED and RELEASED are not sent, the master derives these from the bitmap of pressed buttons.
+    // Thus a lost reply can not result in a lost RELEASED event, which could keep the lift jogging.
+    // The bitmap is always the last part of the reply (see AP_RS485_Lift_Ext.h)
     for (byte i = 0; i < numberOfButtons; i++) {
-      if (myButtons.pressed(i)) {
-        myRS485.sendButtons(PRESSED, i);
-        digitalWrite(LED_YELLOW, HIGH);
-        }
-      else if (myButtons.shortPress(i)) {
-        myRS485.sendButtons(SHORTPRESS, i);
-        }
-      else if (myButtons.longPress(i)) {
-        myRS485.sendButtons(LONGPRESS, i);
-        }
-      else if (myButtons.released(i)) {
-        myRS485.sendButtons(RELEASED, i);
-        }
-      }  // end for loop
+      if (myButtons.pressed(i)) digitalWrite(LED_YELLOW, HIGH);
+      if (myButtons.shortPress(i)) myRS485.sendButtons(SHORTPRESS, i);
+      if (myButtons.longPress(i)) myRS485.sendButtons(LONGPRESS, i);
+      myButtons.released(i);                // Clears the event; released buttons follow from the bitmap
+    }
+    uint16_t pressed = myButtons.allStates();
+    myRS485.sendButtons(REC_SEQUENCE, ++sequence);
+    myRS485.sendButtons(REC_AGE, age());
+    myRS485.sendButtons(REC_PRESSED_LOW, lowByte(pressed));
+    myRS485.sendButtons(REC_PRESSED_HIGH, highByte(pressed));
     // Call as frequent as possible the LED updater  
     MyLeds.update();
   }
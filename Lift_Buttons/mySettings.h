@@ -19,3 +19,11 @@
 // Select the board that will be used. 
 // #define BOARD_SMD
 #define BOARD_THT
+
+
+// 2) Second button panel
+// ======================
+// The Main Lift Controller supports a second button panel, for example on the other side of the
+// layout. Enable the #define below for the second panel only, and set BUTTON_PANELS to 2 in the
+// mySettings.h file of the Main Lift Controller. The LEDs of the second panel are not used.
+// #define SECOND_PANEL
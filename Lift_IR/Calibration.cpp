@@ -0,0 +1,182 @@
+// ***********************************************************************************************************
+// File:       Calibration.cpp
+// Author:     Aiko Pras
+// history:    2026-10-18 V1.0.0 ap initial version
+//
+// purpose:    Tunes the carrier frequency, burst length and thresholds of each IR sensor, and stores these
+//             in EEPROM.
+//
+// ***********************************************************************************************************
+#include <Arduino.h>
+#include <EEPROM.h>
+#include "mySettings.h"
+#include "Calibration.h"
+
+extern IR_Sensors irSensors;
+extern bool debugFlag;
+
+// Instantiate the external object
+Calibration calibration;
+
+
+// The constructor below initialises the object
+Calibration::Calibration() {
+  phase = IDLE;
+  phaseStart = 0;
+  TBlink = 0;
+  setting = 0;
+  sweeping = false;
+  // The settings are stored at the end of the EEPROM. The byte before tells if they have been stored
+  EpromStart = EEPROM.length() - (MAX_SENSORS * sizeof(sensor_settings_t));
+}
+
+
+void Calibration::load() {
+  // Called from setup. Settings that could not be used are replaced by those of mySettings.h
+  if (EEPROM.read(EpromStart - 1) != 0b01010101) return;
+  EEPROM.get(EpromStart, irSensors.settings);
+  for (uint8_t i = 0; i < MAX_SENSORS; i++) {
+    sensor_settings_t &settings = irSensors.settings[i];
+    if (!irSensors.validTiming(settings.top4, settings.top5) || (settings.minLight > 100)
+        || (settings.weakSignal > 100)) irSensors.defaultSettings(i);
+  }
+}
+
+
+void Calibration::reset() {
+  for (uint8_t i = 0; i < MAX_SENSORS; i++) irSensors.defaultSettings(i);
+  EEPROM.update(EpromStart - 1, 0xFF);
+}
+
+
+void Calibration::start() {
+  if (phase != IDLE) return;
+  memset(clear, 100, sizeof(clear));
+  memset(blocked, 0, sizeof(blocked));
+  memset(dark, 0, sizeof(dark));
+  thisRound = 0;
+  blockedSeen = 0;
+  setting = 0;
+  sweeping = false;
+  phase = CLEAR;
+  phaseStart = millis();
+  Serial.println("Calibration - phase 1: all beams should be clear");
+}
+
+
+bool Calibration::running() {
+  return (phase != IDLE);
+}
+
+
+void Calibration::update() {
+  if (phase == IDLE) return;
+  // The yellow LED blinks fast during phase 1 and slowly during phase 2
+  unsigned long blinkTime = (phase == CLEAR) ? 100 : 500;
+  if ((millis() - TBlink) >= blinkTime) {
+    TBlink = millis();
+    digitalWrite(LED_YELLOW, !digitalRead(LED_YELLOW));
+  }
+  // Start a sweep with the next setting. The previous scan may still be busy
+  if (!sweeping) sweeping = irSensors.startSweep(top4(setting), top5(setting));
+  if (!irSensors.sweepComplete()) return;
+  sweeping = false;
+  for (uint8_t i = 0; i < SCAN_SENSORS; i++) {
+    uint8_t strength = irSensors.burstStrength(i);
+    if (phase == CLEAR) clear[i][setting] = min(clear[i][setting], strength);
+    else {
+      rounds[thisRound][i][setting] = strength;
+      if (strength < (clear[i][setting] / 2)) dark[0] |= (1 << i);
+    }
+  }
+  setting = (setting + 1) % CAL_SETTINGS;
+  if (setting != 0) return;
+  if (phase == BLOCK) endRound();
+  // All settings have been tried. Is the phase over?
+  if ((phase == CLEAR) && ((millis() - phaseStart) >= CAL_CLEAR_TIME)) {
+    phase = BLOCK;
+    phaseStart = millis();
+    Serial.println("Calibration - phase 2: block each beam at least once");
+  }
+  else if ((phase == BLOCK) && ((millis() - phaseStart) >= CAL_BLOCK_TIME)) finish();
+}
+
+
+// ***********************************************************************************************************
+uint16_t Calibration::top4(uint8_t setting) {
+  const uint8_t frequencies[CAL_FREQUENCIES] = CAL_KHZ;
+  return 8000 / frequencies[setting / CAL_LENGTHS];
+}
+
+
+uint16_t Calibration::top5(uint8_t setting) {
+  const uint16_t lengths[CAL_LENGTHS] = CAL_BURSTS;
+  return lengths[setting % CAL_LENGTHS] * 16;
+}
+
+
+void Calibration::endRound() {
+  // The previous round counts for sensors that were blocked during that round, as well as during the
+  // round before and the round that just ended. Otherwise the beam may have been clear during part of it
+  uint8_t previous = thisRound ^ 1;
+  uint16_t counted = dark[2] & dark[1] & dark[0];
+  for (uint8_t i = 0; i < SCAN_SENSORS; i++) {
+    if (!(counted & (1 << i))) continue;
+    for (uint8_t s = 0; s < CAL_SETTINGS; s++) blocked[i][s] = max(blocked[i][s], rounds[previous][i][s]);
+  }
+  blockedSeen |= counted;
+  dark[2] = dark[1];
+  dark[1] = dark[0];
+  dark[0] = 0;
+  thisRound = previous;
+}
+
+
+void Calibration::finish() {
+  // Per scan group, select the setting with the largest margin of its worst sensor
+  phase = IDLE;
+  digitalWrite(LED_YELLOW, debugFlag);
+  for (uint8_t g = 0; g < SCAN_GROUPS; g++) {
+    uint16_t sensors = scanGroups[g] & MASK_SENSORS_CONNECTED;
+    if (!sensors) continue;
+    if ((sensors & blockedSeen) != sensors) {
+      Serial.printf("Group %d: beam not blocked, settings not changed\n", g + 1);
+      continue;
+    }
+    int8_t bestMargin = -100;
+    uint8_t best = 0;
+    for (uint8_t s = 0; s < CAL_SETTINGS; s++) {
+      int8_t margin = 100;
+      for (uint8_t i = 0; i < SCAN_SENSORS; i++) {
+        if (!(sensors & (1 << i))) continue;
+        margin = min(margin, (int8_t)(clear[i][s] - blocked[i][s]));
+      }
+      if (margin > bestMargin) {
+        bestMargin = margin;
+        best = s;
+      }
+    }
+    Serial.printf("Group %d: ", g + 1);
+    if (bestMargin < CAL_MIN_MARGIN) {
+      Serial.printf("margin %d%% too small, settings not changed\n", bestMargin);
+      continue;
+    }
+    Serial.printf("%d kHz, %d us, margin %d%%\n", 8000 / top4(best), top5(best) / 16, bestMargin);
+    for (uint8_t i = 0; i < SCAN_SENSORS; i++) {
+      if (!(sensors & (1 << i))) continue;
+      uint8_t range = clear[i][best] - blocked[i][best];
+      irSensors.settings[i].top4 = top4(best);
+      irSensors.settings[i].top5 = top5(best);
+      irSensors.settings[i].minLight = blocked[i][best] + (range / 3);
+      irSensors.settings[i].weakSignal = blocked[i][best] + ((2 * range) / 3);
+      Serial.printf("- Sensor %d: clear %d%%, blocked %d%%\n", i + 1, clear[i][best], blocked[i][best]);
+    }
+  }
+  save();
+}
+
+
+void Calibration::save() {
+  EEPROM.put(EpromStart, irSensors.settings);
+  EEPROM.update(EpromStart - 1, 0b01010101);
+}
@@ -0,0 +1,77 @@
+// ***********************************************************************************************************
+// File:       Calibration.h
+// Author:     Aiko Pras
+// history:    2026-10-18 V1.0.0 ap initial version
+//
+// purpose:    Tunes the carrier frequency, burst length and thresholds of each IR sensor, and stores these
+//             in EEPROM.
+//
+// Reflections may let a receiver see light, although the direct beam is blocked by a train. Which carrier
+// frequency (KHZ) and burst length (BURST_TIME) give the best result differs per sensor. Instead of
+// changing these values in mySettings.h and uploading the sketch again, the calibration mode tries a
+// number of combinations (CAL_KHZ x CAL_BURSTS) for each sensor:
+// - Phase 1 (CAL_CLEAR_TIME ms, yellow LED blinks fast): all beams should be clear. For each combination
+//   the lowest signal strength of each sensor is kept.
+// - Phase 2 (CAL_BLOCK_TIME ms, yellow LED blinks slowly): each beam should be blocked at least once for
+//   a few seconds, for example by stopping a wagon in front of each sensor. A round tries all combinations
+//   once. A beam counts as blocked during a round if, with at least one combination, its strength is
+//   below half of its phase 1 strength. For rounds in which the beam was blocked, and also during the
+//   round before and after (thus the wagon did not move in or out during the round), the highest signal
+//   strength of each combination is kept: the worst reflection while the beam was blocked.
+// The margin of a combination is the difference between both. For each scan group the combination with
+// the largest margin (of the worst sensor in the group) is selected. The signal strength below which
+// the beam counts as blocked is set at one third of the margin above the worst reflection, the strength
+// below which the signal is weak at two thirds. Groups with a beam that was not blocked during phase 2,
+// or whose margin remains below CAL_MIN_MARGIN, keep their previous settings.
+//
+// Calibration is started by pressing the button for CAL_PRESS_TIME ms. While calibrating, no normal scans
+// are performed; since the scan age then grows, the Main Lift Controller considers the sensors busy.
+// The results are shown on the Serial Monitor. Calibration can be repeated at any time; to return to the
+// values of mySettings.h, use reset().
+//
+// ***********************************************************************************************************
+#pragma once
+#include <Arduino.h>
+#include "IR-Sensor.h"
+
+#define CAL_PRESS_TIME   3000        // Time (ms) the button should be pressed to start calibration
+#define CAL_CLEAR_TIME   10000       // Time (ms) of phase 1: all beams clear
+#define CAL_BLOCK_TIME   60000       // Time (ms) of phase 2: each beam blocked at least once
+#define CAL_MIN_MARGIN   20          // Minimum difference (%) between a clear and a blocked beam
+#define CAL_KHZ          {20, 25, 30, 38}     // Carrier frequencies (kHz) that are tried
+#define CAL_BURSTS       {400, 600, 800}      // Burst lengths (us) that are tried
+#define CAL_FREQUENCIES  4
+#define CAL_LENGTHS      3
+#define CAL_SETTINGS     (CAL_FREQUENCIES * CAL_LENGTHS)
+
+class Calibration {
+  public:
+    Calibration();                       // Constructor for initialisation
+    void load();                         // Copies the settings from EEPROM to irSensors
+    void reset();                        // Returns to the settings of mySettings.h
+    void start();                        // Starts calibration
+    void update();                       // Should be called from main as often as possible
+    bool running();                      // True while calibrating
+
+  private:
+    typedef enum {IDLE, CLEAR, BLOCK} phase_t;
+    phase_t phase;
+    unsigned long phaseStart;            // Time (ms) the current phase started
+    unsigned long TBlink;                // Time (ms) the yellow LED was toggled
+    uint8_t setting;                     // Combination of frequency and burst length being tried
+    bool sweeping;                       // A sweep with the current setting is in progress
+    uint8_t clear[SCAN_SENSORS][CAL_SETTINGS];   // Lowest signal strength (%) with the beam clear
+    uint8_t blocked[SCAN_SENSORS][CAL_SETTINGS]; // Highest signal strength (%) with the beam blocked
+    uint8_t rounds[2][SCAN_SENSORS][CAL_SETTINGS]; // Signal strength (%) during this and the previous round
+    uint8_t thisRound;                   // Index in rounds[] of the current round
+    uint16_t dark[3];                    // Sensors blocked during this round, the previous and the one before
+    uint16_t blockedSeen;                // Sensors whose beam was blocked during at least one (counted) round
+    uint16_t EpromStart;                 // First EEPROM address of the settings
+    uint16_t top4(uint8_t setting);      // OCR4A value of a setting
+    uint16_t top5(uint8_t setting);      // OCR5A value of a setting
+    void endRound();                     // Keeps the strengths of the previous round, if its beams were blocked
+    void finish();                       // Selects the best settings and stores these
+    void save();
+};
+
+extern Calibration calibration;
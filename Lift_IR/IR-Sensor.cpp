@@ -3,6 +3,7 @@
 // Author:     Aiko Pras
 // history:    2022-01-25 V1.0.0 ap initial version
 //             2023-12-31 V1.1.0 ap Timer moved to timers.h. Feedback / Debug added
+//             2026-10-18 V1.2.0 ap Background scans, scan groups, signal strength, settings per sensor
 // 
 // purpose:    Control of an IR sensor (LED plus sensor)
 //
@@ -41,99 +42,215 @@ IR_Sensors::IR_Sensors() {
   DDRK = 0xFF;     // PORTK: All outputs
   PORTC = 0xFF;    // PORTC: Pull-up
   PORTL = 0xFF;    // PORTL: Pull-up
+  mode = SCAN;
+  grouped = 0;
+  for (uint8_t i = 0; i < SCAN_GROUPS; i++) grouped |= scanGroups[i];
+  for (uint8_t i = 0; i < MAX_SENSORS; i++) defaultSettings(i);
 }
 
 
-void IR_Sensors::checkStatus(uint8_t sensor) {
-  // A call takes roughly 800us (= BURST_TIME)
-  // STEP 1: BITMASK and PORT determine which IR LED/Sensor pair will be used
-  switch (sensor) {
-    case 0:
-      BITMASK = (1<<0);
-      PORT = LOW;
-    break;
-    case 1:
-      BITMASK = (1<<1);
-      PORT = LOW;
-    break;
-    case 2:
-      BITMASK = (1<<2);
-      PORT = LOW;
-    break;
-    case 3:
-      BITMASK = (1<<3);
-      PORT = LOW;
-    break;
-    case 4:
-      BITMASK = (1<<4);
-      PORT = LOW;
-    break;
-    case 5:
-      BITMASK = (1<<5);
-      PORT = LOW;
-    break;
-    case 6:
-      BITMASK = (1<<6);
-      PORT = LOW;
-    break;
-    case 7:
-      BITMASK = (1<<7);
-      PORT = LOW;
-    break;
-    case 8:
-      BITMASK = (1<<0);
-      PORT = HIGH;
-    break;
-    case 9:
-      BITMASK = (1<<1);
-      PORT = HIGH;
-    break;
-    case 10:
-      BITMASK = (1<<2);
-      PORT = HIGH;
-    break;
-    case 11:
-      BITMASK = (1<<3);
-      PORT = HIGH;
-    break;
-    case 12:
-      BITMASK = (1<<4);
-      PORT = HIGH;
-    break;
-    case 13:
-      BITMASK = (1<<5);
-      PORT = HIGH;
-    break;
-    default:
-    break;
+void IR_Sensors::defaultSettings(uint8_t sensor) {
+  settings[sensor].top4 = 8000 / KHZ;
+  settings[sensor].top5 = BURST_TIME * 16;
+  settings[sensor].minLight = 0;
+  settings[sensor].weakSignal = WEAK_SIGNAL;
+}
+
+
+bool IR_Sensors::validTiming(uint16_t top4, uint16_t top5) {
+  // The carrier should be between 10 and 50 kHz, and the burst at most 63 samples (LIGHT_BITS)
+  if ((top4 < 160) || (top4 > 800) || (top5 == 0)) return false;
+  return ((top5 / top4) <= 63);
+}
+
+
+void IR_Sensors::setBurst(uint8_t burst, uint16_t leds, uint16_t sensors) {
+  uint8_t first = 0;
+  while ((first < (MAX_SENSORS - 1)) && !(sensors & (1 << first))) first++;
+  burstLeds[burst] = leds;
+  burstSensors[burst] = sensors;
+  burstDark[burst] = 0;
+  burstTop4[burst] = settings[first].top4;
+  burstTop5[burst] = settings[first].top5;
+}
+
+
+bool IR_Sensors::startScan() {
+  // One burst per scan group. The bursts follow each other, driven by the Timer 5 interrupt (see timers.h)
+  // The scan starts with a burst without LEDs, during which the dark samples of all groups are taken.
+  // Dark samples taken during the burst of another group would count its cross-talk as ambient light
+  if (scanBusy || scanReady) return false;
+  setDarkBurst(0);
+  for (uint8_t i = 0; i < SCAN_GROUPS; i++) setBurst(i + 1, scanGroups[i], scanGroups[i]);
+  mode = SCAN;
+  startBursts(SCAN_GROUPS + 1);
+  return true;
+}
+
+
+void IR_Sensors::setDarkBurst(uint8_t burst) {
+  // A burst during which all IR-LEDs remain dark, and all grouped IR-receivers are checked
+  setBurst(burst, 0, scanGroups[0]);
+  burstSensors[burst] = 0;
+  burstDark[burst] = grouped;
+}
+
+
+bool IR_Sensors::scanComplete() {
+  // Called by main as often as possible. Returns true once, after all sensors have been checked
+  if (!scanReady || (mode != SCAN)) return false;
+  takeResult();
+  for (uint8_t i = 0; i < SCAN_SENSORS; i++) {
+    if (!(grouped & (1 << i))) continue;
+    if (darkCount[i] && (allSensors[i].ambientHits < 0xFFFF)) allSensors[i].ambientHits++;
+    integrate(i, burstStrength(i));
   }
+  return true;
+}
+
+
+bool IR_Sensors::startTest() {
+  // Cross-talk test for the scan groups. For each sensor, all other IR-LEDs of its group send a burst
+  // while only the IR-receiver of that sensor is checked. If that receiver sees light, it receives light
+  // from an other LED of its group (or from a reflection): the group is not optically independent.
+  // Since a receiver output remains LOW for some time after a burst, each test burst is preceded by a
+  // burst without LEDs.
+  if (scanBusy || scanReady) return false;
+  uint8_t bursts = 0;
+  for (uint8_t i = 0; i < SCAN_GROUPS; i++) {
+    for (uint8_t j = 0; j < SCAN_SENSORS; j++) {
+      uint16_t sensor = (1 << j);
+      if (!(scanGroups[i] & sensor) || (scanGroups[i] == sensor)) continue;
+      if ((bursts + 2) > MAX_BURSTS) break;
+      setBurst(bursts, 0, scanGroups[i]);
+      burstSensors[bursts] = 0;
+      bursts++;
+      setBurst(bursts, scanGroups[i] & ~sensor, scanGroups[i]);
+      burstSensors[bursts] = sensor;
+      bursts++;
+    }
+  }
+  if (bursts == 0) return false;
+  mode = TEST;
+  startBursts(bursts);
+  return true;
+}
+
+
+bool IR_Sensors::testComplete(uint16_t &crossTalk) {
+  // Returns true once, after the cross-talk test has finished. crossTalk holds the sensors whose
+  // receiver has seen light from other LEDs of their group
+  if (!scanReady || (mode != TEST)) return false;
+  crossTalk = takeResult();
+  mode = SCAN;
+  return true;
+}
+
+
+bool IR_Sensors::startSweep(uint16_t top4, uint16_t top5) {
+  // Used for calibration: a scan in which all groups use the same timer values. Sweeps follow each other
+  // without pause, thus the dark burst is preceded by a burst without LEDs and receivers, to give the
+  // receivers of the last group of the previous sweep time to recover
+  if (scanBusy || scanReady) return false;
+  setBurst(0, 0, scanGroups[0]);
+  burstSensors[0] = 0;
+  setDarkBurst(1);
+  for (uint8_t i = 0; i < SCAN_GROUPS; i++) setBurst(i + 2, scanGroups[i], scanGroups[i]);
+  for (uint8_t i = 0; i < (SCAN_GROUPS + 2); i++) {
+    burstTop4[i] = top4;
+    burstTop5[i] = top5;
+  }
+  mode = SWEEP;
+  startBursts(SCAN_GROUPS + 2);
+  return true;
+}
+
+
+bool IR_Sensors::sweepComplete() {
+  // The results remain available via burstStrength() until the next scan is started
+  if (!scanReady || (mode != SWEEP)) return false;
+  takeResult();
+  mode = SCAN;
+  return true;
+}
+
+
+uint8_t IR_Sensors::burstStrength(uint8_t sensor) {
+  // The percentage of samples with light during the burst, minus the percentage during the dark burst
+  uint8_t percent = (lightSamples[sensor]) ? ((uint16_t)lightCount[sensor] * 100) / lightSamples[sensor] : 0;
+  uint8_t ambient = (darkSamples[sensor]) ? ((uint16_t)darkCount[sensor] * 100) / darkSamples[sensor] : 0;
+  return (percent > ambient) ? (percent - ambient) : 0;
+}
+
+
+uint16_t IR_Sensors::ungrouped(uint16_t mask) {
+  // Returns the sensors in mask that are not part of any scan group, and will therefore never be checked
+  return (mask & ~grouped);
+}
+
+
+void IR_Sensors::startBursts(uint8_t bursts) {
+  scanBurst = 0;
+  scanBursts = bursts;
+  scanBusy = true;
+  startBurst(0);
+}
+
+
+uint16_t IR_Sensors::takeResult() {
+  // Converts the vertical counters that the Timer 5 ISR copied at the end of each burst (see timers.h)
+  // into the number of samples with light per checked sensor, for the burst of its own group as well as
+  // for the dark burst. The ISRs do not touch the copies until the next scan is started, thus interrupts
+  // may remain enabled.
+  uint16_t light = 0;
+  for (uint8_t burst = 0; burst < scanBursts; burst++) {
+    for (uint8_t j = 0; j < SCAN_SENSORS; j++) {
+      if (!((burstSensors[burst] | burstDark[burst]) & (1 << j))) continue;
+      uint8_t offset = (j < 8) ? 0 : LIGHT_BITS;
+      uint8_t count = 0;
+      for (uint8_t i = 0; i < LIGHT_BITS; i++) {
+        if (burstCounters[burst][offset + i] & (1 << (j & 7))) count |= (1 << i);
+      }
+      if (burstSensors[burst] & (1 << j)) {
+        lightCount[j] = count;
+        lightSamples[j] = burstSampled[burst];
+        if (count) light |= (1 << j);
+      }
+      else {
+        darkCount[j] = count;
+        darkSamples[j] = burstSampled[burst];
+      }
+    }
+  }
+  scanReady = false;
+  return light;
+}
+
+
+void IR_Sensors::integrate(uint8_t sensor, uint8_t percent) {
   // ******************************************
-  // STEP 2: Turn on the IR-LED
-  START_TIMER4;
-  START_TIMER5;
-  // ******************************************
-  // STEP 3: As long as the IR beam is active (thus as long as Timer 4 is running),
-  // we poll the associated sensor. Becomes true if IR light is detected
-  bool lightSeen = false;
-  if (PORT == LOW)    // inputs numbered 1..8
-    while (TCCR4B) { if (!(PINL & BITMASK)) lightSeen = true; }
-  else               // inputs numbered 9..14
-    while (TCCR4B) { if (!(PINC & BITMASK)) lightSeen = true; }
-  // Make sure all IR-LEDs are switched off and return
-  PORTF = 0;
-  PORTK = 0;
+  // STEP 1: The signal strength is the percentage of samples in which the receiver saw light, minus the
+  // percentage in which it saw (ambient) light while its IR-LED was dark. A smoothed value is kept for
+  // diagnostics.
+  allSensors[sensor].strength = ((3 * (uint16_t)allSensors[sensor].strength) + percent) / 4;
+  allSensors[sensor].lastStrength = percent;
+  // A signal below minLight is a reflection (determined by calibration), and counts as no light
+  bool light = ((percent > 0) && (percent >= settings[sensor].minLight));
   // ******************************************
-  // STEP 4: Store the result in the integrator.
+  // STEP 2: Store the result in the integrator.
   // To limit the effect of reflections, a blocked IR-beam counts more than detected beams.
-  // If the IR-beam is blocked, add 5 (HIGH_STEP) to the integrator
+  // If the IR-beam is blocked, add 10 (HIGH_STEP) to the integrator
   // but use HIGH_TRESHOLD to limit the maximum integrator value
-  if ((!lightSeen) && (allSensors[sensor].integrator < HIGH_TRESHOLD))
+  if ((!light) && (allSensors[sensor].integrator < HIGH_TRESHOLD))
     allSensors[sensor].integrator = allSensors[sensor].integrator + HIGH_STEP;
-  // If the IR-beam is free, decrement the integrator
-  if ((lightSeen) && (allSensors[sensor].integrator > LOW_TRESHOLD))  
-    allSensors[sensor].integrator--;
+  // If the IR-beam is free, decrement the integrator. A strong signal counts more than a weak one
+  if (light) {
+    uint8_t step = (percent >= settings[sensor].weakSignal) ? STRONG_STEP : WEAK_STEP;
+    if (allSensors[sensor].integrator > (LOW_TRESHOLD + step)) allSensors[sensor].integrator -= step;
+      else allSensors[sensor].integrator = LOW_TRESHOLD;
+  }
   // ******************************************
-  // Step 5: update the status for each individual IR-LED / IR Sensor pair
+  // Step 3: update the status for each individual IR-LED / IR Sensor pair
   if ((allSensors[sensor].integrator >= HIGH_TRESHOLD) && (allSensors[sensor].blocked == false)) { 
     allSensors[sensor].blocked = true;
   }
@@ -143,6 +260,41 @@ void IR_Sensors::checkStatus(uint8_t sensor) {
 }
 
 
+uint8_t IR_Sensors::signalStrength(uint8_t sensor) {
+  return allSensors[sensor].strength;
+}
+
+
+uint16_t IR_Sensors::ambientHits(uint8_t sensor) {
+  return allSensors[sensor].ambientHits;
+}
+
+
+uint8_t IR_Sensors::lastStrength(uint8_t sensor) {
+  return allSensors[sensor].lastStrength;
+}
+
+
+uint8_t IR_Sensors::integratorValue(uint8_t sensor) {
+  return allSensors[sensor].integrator;
+}
+
+
+bool IR_Sensors::isBlocked(uint8_t sensor) {
+  return allSensors[sensor].blocked;
+}
+
+
+uint16_t IR_Sensors::marginal(uint16_t mask) {
+  // Returns the sensors in mask whose beam is free, but weak
+  uint16_t bits = 0;
+  for (uint8_t i = 0; i < MAX_SENSORS; i++) {
+    if (!allSensors[i].blocked && (allSensors[i].strength < settings[i].weakSignal)) bits |= (1 << i);
+  }
+  return (bits & mask);
+}
+
+
 
 // ***********************************************************************************************************
 // Functions to determine the Feedback bit
@@ -8,29 +8,94 @@
 //
 // The main sketch calls only:
 // - init_timers()
-// - checkStatus(i)
+// - startScan()
+// - scanComplete()
 // - feedbackBit(mask)
+// - signalStrength(sensor), ambientHits(sensor) and marginal(mask)
+// - lastStrength(sensor), integratorValue(sensor) and isBlocked(sensor), used by SensorHealth.h
+// and, in debugging mode, startTest(), testComplete(crossTalk) and ungrouped(mask)
+// and, during calibration (see Calibration.h), startSweep(top4, top5), sweepComplete() and burstStrength(sensor)
+//
+// Earlier versions checked a sensor by busy-waiting during its whole burst (BURST_TIME), thus the loop
+// was blocked for some 9ms while all sensors were checked. During that time RS-Bus polling and RS485
+// input could not be handled. Now startScan() only starts the burst of the first sensor. The Timer 4
+// interrupt, which toggles the IR-LED, also samples the associated IR-receiver. The Timer 5 interrupt,
+// which ends the burst, stores the result and starts the burst of the next sensor. Once all sensors
+// have been checked, scanComplete() returns true (once) and feeds the results to the integrators.
+//
+// Sensors that can not see each other's IR-LED may be put in the same scan group (see mySettings.h).
+// The IR-LEDs of a group send their burst at the same time, and the IR-receivers of the group are
+// checked at the same time. A scan therefore takes one burst per group instead of one per sensor.
+// The cross-talk test checks a grouping: for each sensor the other LEDs of its group send a burst, while
+// the LED of the sensor itself remains off. If its receiver nevertheless sees light, the grouping is wrong.
 //
 // The software allows a maximum number of MAX_SENSORS sensors. 
 // Each sensor consists of an IR-LED and IR-Sensor.
 // For each individual sensor we maintain a boolean variable 'blocked" and an integrator.
 // The integrator filters spikes: an individual measurement will not immediately lead to a response.  
+// During a burst the receiver is sampled twice per carrier period; the percentage of samples in which it
+// sees light is the signal strength. A beam with a strong signal decrements the integrator twice as fast
+// as a beam with a weak signal (below WEAK_SIGNAL). Beams that are free but weak are reported as marginal:
+// such sensors may start to flap, and should be checked.
+// The samples are counted by the Timer 4 interrupt, in vertical counters (see timers.h). To keep the Timer 5
+// interrupt short, it only copies these counters at the end of each burst; scanComplete(), testComplete()
+// and sweepComplete() convert them into a count per sensor, in the main loop.
+//
+// Sunlight or room lighting may also be seen by a receiver, and could thus hide a blocked beam. Therefore
+// each scan (and each calibration sweep) starts with a burst during which all IR-LEDs remain dark, and
+// all receivers are sampled. Only the difference between both measurements counts as signal, also during
+// calibration. Each scan in which a receiver saw light while all IR-LEDs were dark is counted as an
+// ambient hit. The dark burst costs one BURST_TIME per scan, which fits easily within SCAN_INTERVAL.
+//
+// Each sensor has its own settings: the carrier frequency and burst length (as timer values for OCR4A
+// and OCR5A), the signal strength below which the beam counts as blocked (to ignore reflections) and
+// the strength below which the signal is weak. By default these follow from KHZ, BURST_TIME and
+// WEAK_SIGNAL; the calibration mode tunes them per sensor and stores them in EEPROM. The sensors of a
+// scan group share a burst, and therefore use the timer values of the first sensor of their group.
 //
 //******************************************************************************************************
 #pragma once
 #include "hardware.h" 
 
 
+struct sensor_settings_t {
+  uint16_t top4;                        // OCR4A: half period of the carrier (in 1/16 us)
+  uint16_t top5;                        // OCR5A: length of the burst (in 1/16 us)
+  uint8_t minLight;                     // Signal strength (%) below which the beam counts as blocked
+  uint8_t weakSignal;                   // Signal strength (%) below which the signal is weak
+};
+
+
 class IR_Sensors {
   public:
     #define MAX_SENSORS      16         // Number of IR sensors we could support
     #define LOW_TRESHOLD      0         // Result becomes LOW if integrator reaches this value (default: 0)
-    #define HIGH_TRESHOLD    10         // Number of successive "ticks" before integrator is HIGH
-    #define HIGH_STEP         5         // Number of "ticks" to increase after a "hit"
+    #define HIGH_TRESHOLD    20         // Number of successive "ticks" before integrator is HIGH
+    #define HIGH_STEP        10         // Number of "ticks" to increase after a "hit"
+    #define STRONG_STEP       2         // Number of "ticks" to decrease after a strong signal
+    #define WEAK_STEP         1         // Number of "ticks" to decrease after a weak signal
+    #define WEAK_SIGNAL      25         // Signal strength (%) below which a signal is weak
+    #define SCAN_SENSORS     14         // Number of sensors the board has hardware for (IN/OUT 1..14)
 
     IR_Sensors();                       // Constructor for initialisation
     void init_timers();
-    void checkStatus(uint8_t sensor);  
+    bool startScan();                   // Starts checking all sensors, unless a scan is in progress
+    bool scanComplete();                // True once all sensors have been checked (and integrated)
+    bool startTest();                   // Starts the cross-talk test, unless a scan is in progress
+    bool testComplete(uint16_t &crossTalk); // True once the test is done; crossTalk: sensors that failed
+    uint16_t ungrouped(uint16_t mask);  // Sensors in mask that are not part of any scan group
+    uint8_t signalStrength(uint8_t sensor); // Smoothed signal strength (%) of the sensor
+    uint16_t ambientHits(uint8_t sensor); // Number of scans with light while the IR-LED was dark
+    uint8_t lastStrength(uint8_t sensor); // Signal strength (%) during the last scan (not smoothed)
+    uint8_t integratorValue(uint8_t sensor); // Current value of the integrator of the sensor
+    bool isBlocked(uint8_t sensor);     // Stable state of the sensor
+    uint16_t marginal(uint16_t mask);   // Sensors in mask that are free, but with a weak signal
+    bool startSweep(uint16_t top4, uint16_t top5); // Scan with the same timer values for all sensors
+    bool sweepComplete();               // True once the sweep has been done (not integrated)
+    uint8_t burstStrength(uint8_t sensor); // Signal strength (%) of the sensor during the last burst, minus ambient
+    bool validTiming(uint16_t top4, uint16_t top5); // The counters can hold all samples of the burst
+    sensor_settings_t settings[MAX_SENSORS]; // Settings per sensor
+    void defaultSettings(uint8_t sensor);
     bool feedbackBit(uint16_t mask); 
 
   private:
@@ -38,8 +103,23 @@ class IR_Sensors {
       public:
         uint8_t integrator;          // Integrator values range from LOW_TRESHOLD to HIGH_TRESHOLD
         bool blocked;                // The previous / most recent stable button position
+        uint8_t strength;            // Smoothed signal strength (%)
+        uint8_t lastStrength;        // Signal strength (%) during the last scan
+        uint16_t ambientHits;        // Number of scans with light while the IR-LED was dark
     }; 
    
    Single_Sensor allSensors[MAX_SENSORS]; // Array, one element per sensor
+   void integrate(uint8_t sensor, uint8_t percent); // Feeds the signal strength to the integrator
+   void startBursts(uint8_t bursts);  // Starts the bursts in burstLeds[] and burstSensors[] (timers.h)
+   uint16_t takeResult();             // Returns the sensors that have seen light during the scan
+   uint8_t lightCount[MAX_SENSORS];   // Samples with light during the last burst of each sensor
+   uint8_t lightSamples[MAX_SENSORS]; // Number of samples during the last burst of each sensor
+   uint8_t darkCount[MAX_SENSORS];    // Samples with light during the last dark burst of each sensor
+   uint8_t darkSamples[MAX_SENSORS];  // Number of samples during the last dark burst of each sensor
+   void setBurst(uint8_t burst, uint16_t leds, uint16_t sensors); // Uses the settings of the first sensor
+   void setDarkBurst(uint8_t burst);  // All IR-LEDs dark, all grouped IR-receivers sampled
+   typedef enum {SCAN, TEST, SWEEP} mode_t;
+   mode_t mode;                       // The bursts belong to a scan, a cross-talk test or a sweep
+   uint16_t grouped;                  // Sensors that are part of a scan group
 
 };
@@ -7,6 +7,16 @@
 //            2024/01/06 AP Version 2.0 - Added RSBus feedback, debugging via the Serial interface and LEDs.
 //                                        Before compilation, make sure you've set the variables and #defines
 //                                        contained in the file mySettings
+//            2026/10/18 AP Version 2.1 - The sensors are checked by the timer interrupts, thus the loop is
+//                                        no longer blocked while the IR bursts are being send
+//            2026/10/18 AP Version 2.2 - Scan groups and a cross-talk test (in debugging mode)
+//            2026/10/18 AP Version 2.3 - The sensors are scanned continuously; POLLs are answered at once
+//            2026/10/18 AP Version 2.4 - Signal strength per sensor; marginal sensors via RS-Bus (optional)
+//            2026/10/18 AP Version 2.5 - Calibration of the settings per sensor, stored in EEPROM
+//            2026/10/18 AP Version 2.6 - Ambient light is measured and subtracted
+//            2026/10/18 AP Version 2.7 - Sensor health (flapping, stuck, never saw light); via RS-Bus (optional)
+//            2026/10/18 AP Version 2.8 - Direction and speed of trains along a track; tracks are released
+//                                        as soon as a train has passed (optional, see mySettings.h)
 // 
 // The code is has been tested on the following lift controller boards 
 // - SMD board: https://oshwlab.com/aikopras/support-lift-controller
@@ -22,23 +32,46 @@
 // - Yellow: Decoder is in debugging mode
 // - Red: Blinks whenever a RSbus feedback message is send. Also twice at startup.
 //
-// Button: if pushed, debugging mode is turned on/off. 
+// Button: if pushed, debugging mode is turned on/off. If pushed for 3 seconds, calibration starts
+// (see Calibration.h); debugging mode is then turned on to show the results.
 // In debugging mde, status information of each individual sensor will be send over the Serial Monitor. 
+// Every 10 seconds the signal strength of each sensor is shown and the scan groups are tested for cross-talk.
 //
 // ***********************************************************************************************************
 //                                           Do not edit below this line
 // ***********************************************************************************************************
 #include <AP_DCC_Decoder_Core.h>      // Library for a basic DCC accesory decoder with RS-Bus feedback
 #include <AP_RS485_Lift.h>            // Library to communicate with the main lift decoder
+#include <AP_RS485_Lift_Ext.h>        // For the sensor records and the address of a second IR board
 #include "mySettings.h" 
 #include "hardware.h" 
 #include "IR-Sensor.h"
+#include "Calibration.h"
+#include "SensorHealth.h"
+#include "Tracks.h"
 
-RS485_Lift myRS485(IR_LEDS_ADDR);    // Instantiate the myRS485 object
+#if defined(SECOND_BOARD)             // A second IR board uses its own address (see mySettings.h)
+  RS485_Lift myRS485(IR_LEDS_ADDR_2);  // Instantiate the myRS485 object
+#else
+  RS485_Lift myRS485(IR_LEDS_ADDR);    // Instantiate the myRS485 object
+#endif
 
 IR_Sensors irSensors;                // Instantiate the irSensors object
-uint16_t sensorValuesNew = 0;        // Set every 100ms by IR_Sensors::feedbackBit
+uint16_t sensorValuesNew = 0;        // Set after every scan by IR_Sensors::feedbackBit
 uint16_t sensorValues = 0;           // Old values
+unsigned long changeTime;            // Time (millis) the sensor values last changed
+bool changeSeen = false;             // The sensor values changed since start-up
+bool allFree = false;                // All connected sensors were free during the last scan
+unsigned long TScan;                 // Time (ms) the last scan was started
+unsigned long scanTime;              // Time (ms) the last scan completed
+bool scanned = false;                // At least one scan has completed
+
+// Responsiveness, shown every 10 seconds in debug mode
+unsigned long loopStart;             // Time (us) the current loop started
+unsigned long maxLoopTime = 0;       // Longest time (us) between two loop() calls
+unsigned long maxReplyTime = 0;      // Longest time (us) between POLL and reply
+unsigned long TShow;                 // Time (ms) the responsiveness was shown the last time
+bool testRequested = false;          // A cross-talk test should be performed once no scan is in progress
 
 DccLed redLed;                       // LED that signals transmission of RSBus messages
 DccButton button;                    // Push to enter debug mode (use Serial interface for sensor feedback) 
@@ -48,6 +81,23 @@ extern RSbusHardware rsbusHardware;  // This object is defined and instantiated
 RSbusConnection rsbusFirst;          // Object that represents the sensors 1..8
 RSbusConnection rsbusSecond;         // Object that represents the sensors 9..16
 unsigned long TLast;                 // Support variable for RSBus transmission
+uint16_t marginalValuesNew = 0;      // Sensors that are free, but have a weak signal
+uint16_t marginalValues = 0;         // Old values
+#if defined(MARGINAL_FEEDBACK)
+RSbusConnection rsbusMarginalFirst;  // Object that represents the marginal state of sensors 1..8
+RSbusConnection rsbusMarginalSecond; // Object that represents the marginal state of sensors 9..16
+#endif
+uint16_t healthValuesNew = 0;        // Sensors that are flapping, stuck or never saw light
+uint16_t healthValues = 0;           // Old values
+#if defined(HEALTH_FEEDBACK)
+RSbusConnection rsbusHealthFirst;    // Object that represents the health of sensors 1..8
+RSbusConnection rsbusHealthSecond;   // Object that represents the health of sensors 9..16
+#endif
+uint8_t trackValuesNew = 0;          // Per track two bits: last passage into / out of the lift
+uint8_t trackValues = 0;             // Old values
+#if defined(TRACK_FEEDBACK)
+RSbusConnection rsbusTracks;         // Object that represents the direction of the last passage per track
+#endif
 
 
 // ***********************************************************************************************************
@@ -64,11 +114,23 @@ void setup() {
   //
   // The timers (4 and 5) are used to create the IR beam
   irSensors.init_timers();
+  calibration.load();         // The settings per sensor, if calibrated
   //
   // RSbus specific initialisation
   rsbusHardware.attach(rsBusUsart, rsBusRX);
   rsbusFirst.address = RS_AddresLow;
   rsbusSecond.address = RS_AddresHigh;
+  #if defined(MARGINAL_FEEDBACK)
+  rsbusMarginalFirst.address = RS_AddresMarginalLow;
+  rsbusMarginalSecond.address = RS_AddresMarginalHigh;
+  #endif
+  #if defined(HEALTH_FEEDBACK)
+  rsbusHealthFirst.address = RS_AddresHealthLow;
+  rsbusHealthSecond.address = RS_AddresHealthHigh;
+  #endif
+  #if defined(TRACK_FEEDBACK)
+  rsbusTracks.address = RS_AddresTracks;
+  #endif
   redLed.attach(ledPin);
   TLast = millis();
   //
@@ -79,10 +141,23 @@ void setup() {
   debugFlag = 0;
   //
   redLed.start_up();          // Blink twice to indicate startup
+  loopStart = micros();
+  TShow = millis();
+  TScan = millis();
 }
 
 
 // *** RSBus ***
+void PrepareDiagnostics(RSbusConnection &first, RSbusConnection &second, uint16_t oldValues, uint16_t newValues) {
+  // As PrepareRSBusFeedback, for the diagnostic bitmaps (marginal sensors and sensor health)
+  if ((oldValues & 0x000F) != (newValues & 0x000F)) first.send4bits(LowBits,    newValues & 0x000F);
+  if ((oldValues & 0x00F0) != (newValues & 0x00F0)) first.send4bits(HighBits,  (newValues & 0x00F0) >> 4);
+  if ((oldValues & 0x0F00) != (newValues & 0x0F00)) second.send4bits(LowBits,  (newValues & 0x0F00) >> 8);
+  if ((oldValues & 0xF000) != (newValues & 0xF000)) second.send4bits(HighBits, (newValues & 0xF000) >> 12);
+  if (oldValues != newValues) redLed.feedback();
+}
+
+
 void PrepareRSBusFeedback() {
   // Stores in a buffer RSBus feedback messages for sensor values that have been changed
   if (rsbusHardware.rsSignalIsOK) {
@@ -91,6 +166,17 @@ void PrepareRSBusFeedback() {
     if ((sensorValues & 0x0F00) != (sensorValuesNew & 0x0F00)) rsbusSecond.send4bits(LowBits,  (sensorValuesNew & 0x0F00) >> 8);
     if ((sensorValues & 0xF000) != (sensorValuesNew & 0xF000)) rsbusSecond.send4bits(HighBits, (sensorValuesNew & 0xF000) >> 12);
     if (sensorValues != sensorValuesNew) redLed.feedback();
+    #if defined(MARGINAL_FEEDBACK)
+    PrepareDiagnostics(rsbusMarginalFirst, rsbusMarginalSecond, marginalValues, marginalValuesNew);
+    #endif
+    #if defined(HEALTH_FEEDBACK)
+    PrepareDiagnostics(rsbusHealthFirst, rsbusHealthSecond, healthValues, healthValuesNew);
+    #endif
+    #if defined(TRACK_FEEDBACK)
+    if ((trackValues & 0x0F) != (trackValuesNew & 0x0F)) rsbusTracks.send4bits(LowBits,   trackValuesNew & 0x0F);
+    if ((trackValues & 0xF0) != (trackValuesNew & 0xF0)) rsbusTracks.send4bits(HighBits, (trackValuesNew & 0xF0) >> 4);
+    if (trackValues != trackValuesNew) redLed.feedback();
+    #endif
   }
 }
 
@@ -108,6 +194,22 @@ void SendRSBusFeedback() {
     // Check if the RSBus buffer contains feedback messages, and give these to the ISR and USART for actual transmission
     rsbusFirst.checkConnection();
     rsbusSecond.checkConnection();
+    #if defined(MARGINAL_FEEDBACK)
+    if (rsbusMarginalFirst.feedbackRequested)  rsbusMarginalFirst.send8bits(0);
+    if (rsbusMarginalSecond.feedbackRequested) rsbusMarginalSecond.send8bits(0);
+    rsbusMarginalFirst.checkConnection();
+    rsbusMarginalSecond.checkConnection();
+    #endif
+    #if defined(HEALTH_FEEDBACK)
+    if (rsbusHealthFirst.feedbackRequested)  rsbusHealthFirst.send8bits(0);
+    if (rsbusHealthSecond.feedbackRequested) rsbusHealthSecond.send8bits(0);
+    rsbusHealthFirst.checkConnection();
+    rsbusHealthSecond.checkConnection();
+    #endif
+    #if defined(TRACK_FEEDBACK)
+    if (rsbusTracks.feedbackRequested) rsbusTracks.send8bits(0);
+    rsbusTracks.checkConnection();
+    #endif
   }
 }
 
@@ -135,65 +237,225 @@ void IniSerial() {
   Serial.print(RS_AddresLow);
   Serial.print(" & ");
   Serial.println(RS_AddresHigh);
+  Serial.print("- Scan groups: ");
+  Serial.print(SCAN_GROUPS);
+  Serial.print(" (scan time: ");
+  Serial.print((SCAN_GROUPS + 1) * BURST_TIME);
+  Serial.println(" microseconds)");
+  Serial.print("- Settings per sensor (kHz/us/min%/weak%):");
+  for (uint8_t i = 0; i < MAX_SENSORS; i++) {
+    if (!(MASK_SENSORS_CONNECTED & (1 << i))) continue;
+    sensor_settings_t &settings = irSensors.settings[i];
+    Serial.printf(" %d:%d/%d/%d/%d", i + 1, 8000 / settings.top4, settings.top5 / 16, settings.minLight,
+                  settings.weakSignal);
+  }
+  Serial.println();
+  Serial.print("- Scan interval: ");
+  Serial.print(SCAN_INTERVAL);
+  Serial.println(" ms");
+  #if defined(TRACKS)
+  Serial.printf("- Tracks: %d (sensor spacing: %d mm)\n", TRACKS, SENSOR_SPACING);
+  #endif
+  uint16_t ungrouped = irSensors.ungrouped(MASK_SENSORS_CONNECTED);
+  if (ungrouped) Serial.printf("- Connected sensors not in any scan group (never checked): %x\n", ungrouped);
   Serial.println();
   Serial.println("Sensor values (in HEX format - Free = 0):");
 }
 
 
+void showSignalStrength() {
+  // Shows the smoothed signal strength (%) of each connected sensor, and the marginal sensors
+  Serial.print("Signal strength (%):");
+  for (uint8_t i = 0; i < MAX_SENSORS; i++) {
+    if (!(MASK_SENSORS_CONNECTED & (1 << i))) continue;
+    Serial.print(" ");
+    Serial.print(i + 1);
+    Serial.print(":");
+    Serial.print(irSensors.signalStrength(i));
+  }
+  Serial.println();
+  Serial.print("Ambient hits:");
+  for (uint8_t i = 0; i < MAX_SENSORS; i++) {
+    if (!(MASK_SENSORS_CONNECTED & (1 << i))) continue;
+    Serial.print(" ");
+    Serial.print(i + 1);
+    Serial.print(":");
+    Serial.print(irSensors.ambientHits(i));
+  }
+  Serial.println();
+  Serial.printf("Marginal: %x\n", marginalValuesNew);
+  sensorHealth.show();
+}
+
+
+void showResponsiveness() {
+  // Shows every 10 seconds the longest loop time and POLL-reply time. While the sensors were checked
+  // within the loop, the loop time was the time needed to check all sensors: some 9 to 11 ms. While
+  // the scan started after the POLL, the reply time was the time needed for a scan.
+  if (!debugFlag) return;
+  if ((millis() - TShow) < 10000) return;
+  TShow = millis();
+  Serial.print("Max loop time: ");
+  Serial.print(maxLoopTime);
+  Serial.print("us - max reply time: ");
+  Serial.print(maxReplyTime);
+  Serial.println("us");
+  maxLoopTime = 0;
+  maxReplyTime = 0;
+  showSignalStrength();
+  testRequested = true;
+}
+
+
+void crossTalkTest() {
+  // The test runs between two scans. Its result is shown as a bitmap of the connected sensors whose
+  // IR-receiver has seen light while their own IR-LED was off (0 = grouping is fine)
+  uint16_t crossTalk;
+  if (testRequested && !calibration.running() && irSensors.startTest()) testRequested = false;
+  if (irSensors.testComplete(crossTalk) && debugFlag) 
+    Serial.printf("Cross-talk: %x\n", crossTalk & MASK_SENSORS_CONNECTED);
+}
+
+
 void debugMode() {
-  // Step 1: Do we need to send any info via the Serial interface?
+  // Do we need to send any info via the Serial interface?
   if (debugFlag) {
     if (sensorValues != sensorValuesNew) 
       Serial.printf("%x\n", sensorValuesNew);
   }
-  // Step 2: if button was pushed, toggle LED and debugFlag
+}
+
+
+void trackPassages() {
+  // Determines per track the direction and speed of trains. The sensors of a track that a train has
+  // fully passed are reported free, even if their integrators still consider them blocked
+  #if defined(TRACKS)
+  trainTracks.update();
+  sensorValuesNew &= ~trainTracks.released();
+  allFree = (sensorValuesNew == 0);
+  for (uint8_t t = 0; t < TRACKS; t++) {
+    if (!trainTracks.passed(t)) continue;
+    TrainTracks::direction_t direction = trainTracks.direction(t);
+    if (t < 4) {
+      trackValuesNew &= ~(0b11 << (2 * t));
+      if (direction == TrainTracks::INTO_LIFT) trackValuesNew |= (0b01 << (2 * t));
+      if (direction == TrainTracks::OUT_OF_LIFT) trackValuesNew |= (0b10 << (2 * t));
+    }
+    if (debugFlag) {
+      Serial.printf("Track %d: ", t + 1);
+      if (direction == TrainTracks::INTO_LIFT) Serial.print("into the lift");
+        else if (direction == TrainTracks::OUT_OF_LIFT) Serial.print("out of the lift");
+        else Serial.print("direction unknown");
+      Serial.printf(", %d mm/s\n", trainTracks.speed(t));
+    }
+  }
+  #endif
+}
+
+
+void checkButton() {
+  // If button was pushed, toggle LED and debugFlag. If it was pushed long, start calibration instead
+  static bool longPress = false;
   button.read();
+  if (button.pressedFor(CAL_PRESS_TIME) && !longPress) {
+    longPress = true;
+    if (!debugFlag) {
+      debugFlag = 1;
+      IniSerial();
+    }
+    calibration.start();
+  }
   if (button.wasReleased()) {
-    toggleLed(LED_YELLOW);
-    if (debugFlag) {
+    if (longPress) longPress = false;
+    else if (debugFlag) {
       debugFlag = 0;
+      clearLed(LED_YELLOW);
     }
     else {
       debugFlag = 1;
+      setLed(LED_YELLOW);
       IniSerial();
     }
   }
 }
  
 
+// ***********************************************************************************************************
+uint8_t age(bool seen, unsigned long time) {
+  // Time (ms) since time, for the REC_SENSORS_AGE and REC_SCAN_AGE records
+  time = millis() - time;
+  if (!seen || (time >= AGE_UNKNOWN)) return AGE_UNKNOWN;
+  return time;
+}
+
+
 // ***********************************************************************************************************
 void loop() {
-  // Every 100ms we should receive a POLL message from the master controller.
-  // After reception, we poll all sensors. 
-  // To the master controller we reply with a RS485 message containing a single bit, indicating if all sensors
-  // are free or not. Total time between reception of the POLL and transmission of the REPLAY is less than 10ms.
-  // If the value of any sensors changed, a RSBus feedback message is send to tell which sensor changed.
-  if (myRS485.input()) {    
-    toggleLed(LED_BLUE);
-    // STEP 1: Check all IR sensors, also those not connected
-    for (uint8_t i=0; i < (MAX_SENSORS); i++) {
-      irSensors.checkStatus(i);       
-    }
+  // The sensors are checked continuously in the background: every SCAN_INTERVAL ms a scan is started.
+  // The checks are performed by the timer interrupts (see timers.h), thus the loop continues to run and
+  // handle the RS-Bus and RS485 while the IR bursts are send. Once a scan is complete, the results are
+  // integrated and, if the value of any sensors changed, a RSBus feedback message is send.
+  // Every 100ms we should receive a POLL message from the master controller. We reply immediately with
+  // the state of every sensor of the last scan (a 16 bit bitmap, bit i set if sensor i is blocked),
+  // followed by a RS485 message containing a single bit, indicating if all sensors are free or not. The
+  // master uses the bitmap to check only those sensors that matter for the level the lift is at or moves
+  // to. The reply also tells how long ago the last scan completed.
+  unsigned long now = micros();
+  if ((now - loopStart) > maxLoopTime) maxLoopTime = now - loopStart;
+  loopStart = now;
+  // STEP 1: Start the next scan. If a cross-talk test is in progress, the scan starts after the test.
+  // During calibration no scans are performed
+  if (calibration.running()) calibration.update();
+  else if (((millis() - TScan) >= SCAN_INTERVAL) && irSensors.startScan()) TScan = millis();
+  if (irSensors.scanComplete()) {
     // STEP 2: Determine the result value
     // A mask is used, to ensure we only check the sensors that are connected
-    bool result = irSensors.feedbackBit(MASK_SENSORS_CONNECTED);
-    // STEP 3: Send the result value via the RS485 bus and set the green LED
-    if ((result)) {
-      myRS485.sendIrSensorsFree();
-      setLed(LED_GREEN);
+    allFree = irSensors.feedbackBit(MASK_SENSORS_CONNECTED);
+    marginalValuesNew = irSensors.marginal(MASK_SENSORS_CONNECTED);
+    sensorHealth.update();
+    healthValuesNew = sensorHealth.faulty(MASK_SENSORS_CONNECTED);
+    trackPassages();
+    scanTime = millis();
+    scanned = true;
+    if (sensorValuesNew != sensorValues) {
+      changeTime = scanTime;
+      changeSeen = true;
     }
-      else {
-        myRS485.sendIrSensorsBusy();
-        clearLed(LED_GREEN);
-      }
-    // STEP 4: Any changes that need to be send via the RSBus?
+    if (allFree) setLed(LED_GREEN);
+      else clearLed(LED_GREEN);
+    // STEP 3: Any changes that need to be send via the RSBus?
     PrepareRSBusFeedback();
-    // STEP 5: Check debug button / send sensor info via serial interface
+    // STEP 4: Send sensor info via serial interface
     debugMode();  
-    // STEP 6: update sensorValues
+    // STEP 5: update sensorValues
     sensorValues = sensorValuesNew;
+    marginalValues = marginalValuesNew;
+    healthValues = healthValuesNew;
+    trackValues = trackValuesNew;
+  }
+  if (myRS485.input()) {    
+    toggleLed(LED_BLUE);
+    // STEP 6: Send the bitmap of the last scan and the result value via the RS485 bus
+    // The bitmap and the ages are send as records (see AP_RS485_Lift_Ext.h); the result value ends the reply
+    // If TRACKS is defined, two records per track follow with speed, direction and number of passages
+    myRS485.sendButtons(REC_SENSORS_LOW, lowByte(sensorValues));
+    myRS485.sendButtons(REC_SENSORS_HIGH, highByte(sensorValues));
+    myRS485.sendButtons(REC_SENSORS_AGE, age(changeSeen, changeTime));
+    myRS485.sendButtons(REC_SCAN_AGE, age(scanned, scanTime));
+    #if defined(TRACKS)
+    for (uint8_t t = 0; t < TRACKS; t++) {
+      myRS485.sendButtons(REC_TRACK_SPEED + t, trainTracks.cmSpeed(t));
+      myRS485.sendButtons(REC_TRACK_INFO + t, trainTracks.info(t));
+    }
+    #endif
+    if (allFree) myRS485.sendIrSensorsFree();
+      else myRS485.sendIrSensorsBusy();
+    if ((micros() - now) > maxReplyTime) maxReplyTime = micros() - now;
   }
   // STEP 7: check as often as possible RSBus activity and LED
   SendRSBusFeedback();
   redLed.update();
+  showResponsiveness();
+  crossTalkTest();
+  checkButton();
 }
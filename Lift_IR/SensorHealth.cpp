@@ -0,0 +1,99 @@
+// ***********************************************************************************************************
+// File:       SensorHealth.cpp
+// Author:     Aiko Pras
+// history:    2026-10-18 V1.0.0 ap initial version
+//
+// purpose:    Keeps track of the health of each IR sensor, to find faulty sensors without trial and error.
+//
+// ***********************************************************************************************************
+#include <Arduino.h>
+#include "mySettings.h"
+#include "SensorHealth.h"
+
+extern IR_Sensors irSensors;
+
+// Instantiate the external object
+SensorHealth sensorHealth;
+
+
+// The constructor below initialises the object
+SensorHealth::SensorHealth() {
+  memset(sensors, 0, sizeof(sensors));
+  lightSeen = 0;
+  windowStart = 0;
+}
+
+
+void SensorHealth::update() {
+  unsigned long now = millis();
+  bool newWindow = ((now - windowStart) >= HEALTH_WINDOW);
+  if (newWindow) windowStart = now;
+  for (uint8_t i = 0; i < SCAN_SENSORS; i++) {
+    health_t &health = sensors[i];
+    if (newWindow) {
+      health.lastChanges = health.changes;
+      health.changes = 0;
+      health.scansSaturated = 0;
+      health.scansBetween = 0;
+    }
+    if (irSensors.lastStrength(i) > 0) lightSeen |= (1 << i);
+    bool blocked = irSensors.isBlocked(i);
+    if (blocked != health.blocked) {
+      health.blocked = blocked;
+      health.lastChange = now;
+      if (health.changes < 255) health.changes++;
+    }
+    uint8_t integrator = irSensors.integratorValue(i);
+    if ((integrator <= LOW_TRESHOLD) || (integrator >= HIGH_TRESHOLD)) {
+      if (health.scansSaturated < 0xFFFF) health.scansSaturated++;
+    }
+    else if (health.scansBetween < 0xFFFF) health.scansBetween++;
+  }
+}
+
+
+uint16_t SensorHealth::flapping(uint16_t mask) {
+  uint16_t bits = 0;
+  for (uint8_t i = 0; i < SCAN_SENSORS; i++) {
+    if ((sensors[i].changes > FLAP_LIMIT) || (sensors[i].lastChanges > FLAP_LIMIT)) bits |= (1 << i);
+  }
+  return (bits & mask);
+}
+
+
+uint16_t SensorHealth::stuck(uint16_t mask) {
+  uint16_t bits = 0;
+  for (uint8_t i = 0; i < SCAN_SENSORS; i++) {
+    if (sensors[i].blocked && ((millis() - sensors[i].lastChange) >= STUCK_TIME)) bits |= (1 << i);
+  }
+  return (bits & mask);
+}
+
+
+uint16_t SensorHealth::neverLight(uint16_t mask) {
+  return (~lightSeen & mask);
+}
+
+
+uint16_t SensorHealth::faulty(uint16_t mask) {
+  return (flapping(mask) | stuck(mask) | neverLight(mask));
+}
+
+
+void SensorHealth::show() {
+  const uint16_t inputs = (1 << SCAN_SENSORS) - 1;
+  Serial.printf("Flapping: %x - stuck: %x - never saw light: %x\n", flapping(MASK_SENSORS_CONNECTED),
+                stuck(MASK_SENSORS_CONNECTED), neverLight(MASK_SENSORS_CONNECTED));
+  if ((lightSeen & inputs) != MASK_SENSORS_CONNECTED)
+    Serial.printf("Inputs that saw light: %x - MASK_SENSORS_CONNECTED: %x\n", lightSeen & inputs,
+                  MASK_SENSORS_CONNECTED);
+  Serial.print("Changes / saturated (%):");
+  for (uint8_t i = 0; i < SCAN_SENSORS; i++) {
+    if (!(MASK_SENSORS_CONNECTED & (1 << i))) continue;
+    health_t &health = sensors[i];
+    uint32_t scans = (uint32_t)health.scansSaturated + health.scansBetween;
+    Serial.printf(" %d:%d/%d", i + 1, max(health.changes, health.lastChanges),
+                  scans ? (int)((health.scansSaturated * 100UL) / scans) : 100);
+  }
+  Serial.println();
+}
@@ -0,0 +1,56 @@
+// ***********************************************************************************************************
+// File:       SensorHealth.h
+// Author:     Aiko Pras
+// history:    2026-10-18 V1.0.0 ap initial version
+//
+// purpose:    Keeps track of the health of each IR sensor, to find faulty sensors without trial and error.
+//
+// After each scan, update() checks for every sensor on the board (also those not in MASK_SENSORS_CONNECTED):
+// - Flapping: the sensor changed between blocked and free more than FLAP_LIMIT times during the last
+//   HEALTH_WINDOW ms. A train passing a beam gives two changes; many more indicate a marginal or
+//   misaligned beam, or interference.
+// - Stuck: the sensor has been blocked for more than STUCK_TIME ms without a change. A train may of
+//   course be parked in front of a sensor, but more often the LED or receiver has failed.
+// - Never saw light: the receiver has not seen light since start-up. This is the case for inputs where no
+//   sensor is connected; the map of inputs that did see light therefore tells the actual value for
+//   MASK_SENSORS_CONNECTED.
+// In addition, the number of scans during which the integrator was saturated (at HIGH_TRESHOLD or
+// above, or at LOW_TRESHOLD) and during which it was in between, is counted per sensor. A healthy sensor
+// is saturated nearly all the time; many scans in between indicate an unreliable signal.
+// The combined health bits (flapping, stuck or never saw light) of the connected sensors may be reported
+// via the RS-Bus (see mySettings.h); in debugging mode all values are shown every 10 seconds.
+//
+// ***********************************************************************************************************
+#pragma once
+#include <Arduino.h>
+#include "IR-Sensor.h"
+
+#define HEALTH_WINDOW    60000       // Time (ms) over which the changes are counted
+#define FLAP_LIMIT       20          // Number of changes per window above which a sensor is flapping
+#define STUCK_TIME       600000      // Time (ms) blocked without change after which a sensor is stuck
+
+class SensorHealth {
+  public:
+    SensorHealth();                      // Constructor for initialisation
+    void update();                       // Should be called after each scan
+    uint16_t flapping(uint16_t mask);    // Sensors in mask that are flapping
+    uint16_t stuck(uint16_t mask);       // Sensors in mask that are stuck
+    uint16_t neverLight(uint16_t mask);  // Sensors in mask that never saw light
+    uint16_t faulty(uint16_t mask);      // Sensors in mask that are flapping, stuck or never saw light
+    void show();                         // Shows the health of the connected sensors on the Serial Monitor
+
+  private:
+    struct health_t {
+      bool blocked;                      // State after the previous scan
+      uint8_t changes;                   // Number of changes during the current window
+      uint8_t lastChanges;               // Number of changes during the previous window
+      unsigned long lastChange;          // Time (ms) of the last change
+      uint16_t scansSaturated;           // Scans with the integrator at LOW_TRESHOLD or HIGH_TRESHOLD
+      uint16_t scansBetween;             // Scans with the integrator in between
+    };
+    health_t sensors[SCAN_SENSORS];
+    uint16_t lightSeen;                  // Sensors that saw light since start-up
+    unsigned long windowStart;           // Time (ms) the current window started
+};
+
+extern SensorHealth sensorHealth;
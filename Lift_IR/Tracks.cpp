@@ -0,0 +1,178 @@
+// ***********************************************************************************************************
+// File:       Tracks.cpp
+// Author:     Aiko Pras
+// history:    2026-10-18 V1.0.0 ap initial version
+//
+// purpose:    Estimates direction and speed of trains that pass the IR sensors along a track, and detects
+//             when a train has fully passed.
+//
+// ***********************************************************************************************************
+#include <Arduino.h>
+#include "Tracks.h"
+
+#if defined(TRACKS)
+
+extern IR_Sensors irSensors;
+
+// Instantiate the external object
+TrainTracks trainTracks;
+
+
+// The constructor below initialises the object
+TrainTracks::TrainTracks() {
+  memset(tracks, 0, sizeof(tracks));
+  memset(lightScans, 0, sizeof(lightScans));
+}
+
+
+void TrainTracks::update() {
+  unsigned long now = millis();
+  for (uint8_t i = 0; i < SCAN_SENSORS; i++) {
+    uint8_t strength = irSensors.lastStrength(i);
+    bool light = ((strength > 0) && (strength >= irSensors.settings[i].minLight));
+    if (!light) lightScans[i] = 0;
+      else if (lightScans[i] < 255) lightScans[i]++;
+  }
+  for (uint8_t t = 0; t < TRACKS; t++) {
+    track_t &track = tracks[t];
+    bool anyBlocked = false;             // According to the integrators
+    bool allPassed = true;               // All sensors have been blocked during this passage
+    bool allLight = true;                // All sensors saw light during the last FAST_CLEAR_SCANS scans
+                                         // and their integrators are below HIGH_TRESHOLD / 2
+    bool anyDark = false;                // A sensor saw no light during the last scan
+    for (uint8_t k = 0; k < TRACK_SENSORS; k++) {
+      if (trackSensors[t][k] == 0) continue;
+      uint8_t sensor = trackSensors[t][k] - 1;
+      if (irSensors.isBlocked(sensor)) anyBlocked = true;
+      if (lightScans[sensor] < FAST_CLEAR_SCANS) allLight = false;
+      if (irSensors.integratorValue(sensor) >= (HIGH_TRESHOLD / 2)) allLight = false;
+      if (lightScans[sensor] == 0) anyDark = true;
+      if ((track.state == PASSING) && irSensors.isBlocked(sensor) && (track.blockTime[k] == 0))
+        track.blockTime[k] = now;
+      // The time the tail of the train passed the sensor. A scan without light cancels it
+      if (lightScans[sensor] == 0) track.freeTime[k] = 0;
+        else if ((track.blockTime[k] != 0) && (track.freeTime[k] == 0)) track.freeTime[k] = now;
+      if (track.blockTime[k] == 0) allPassed = false;
+    }
+    switch (track.state) {
+      case IDLE:
+        if (!anyBlocked) break;
+        // A new passage. The block times are recorded from the next update on
+        memset(track.blockTime, 0, sizeof(track.blockTime));
+        memset(track.freeTime, 0, sizeof(track.freeTime));
+        for (uint8_t k = 0; k < TRACK_SENSORS; k++) {
+          if (trackSensors[t][k] && irSensors.isBlocked(trackSensors[t][k] - 1)) track.blockTime[k] = now;
+        }
+        track.direction = UNKNOWN;
+        track.speed = 0;
+        track.state = PASSING;
+      break;
+      case PASSING:
+        estimate(track);
+        if (!anyBlocked) {
+          complete(track);
+          track.state = IDLE;
+        }
+        else if (allPassed && allLight && inOrder(t)) {
+          complete(track);
+          track.state = CLEAR;
+        }
+      break;
+      case CLEAR:
+        if (anyDark) {
+          memset(track.blockTime, 0, sizeof(track.blockTime));
+          memset(track.freeTime, 0, sizeof(track.freeTime));
+          track.direction = UNKNOWN;
+          track.speed = 0;
+          track.state = PASSING;
+        }
+        else if (!anyBlocked) track.state = IDLE;
+      break;
+    }
+  }
+}
+
+
+uint16_t TrainTracks::released() {
+  uint16_t bits = 0;
+  for (uint8_t t = 0; t < TRACKS; t++) {
+    if (tracks[t].state != CLEAR) continue;
+    for (uint8_t k = 0; k < TRACK_SENSORS; k++) {
+      if (trackSensors[t][k]) bits |= (1 << (trackSensors[t][k] - 1));
+    }
+  }
+  return bits;
+}
+
+
+bool TrainTracks::passed(uint8_t track) {
+  bool result = tracks[track].passed;
+  tracks[track].passed = false;
+  return result;
+}
+
+
+TrainTracks::direction_t TrainTracks::direction(uint8_t track) {
+  return tracks[track].direction;
+}
+
+
+uint16_t TrainTracks::speed(uint8_t track) {
+  return tracks[track].speed;
+}
+
+
+uint8_t TrainTracks::info(uint8_t track) {
+  // Bits 0..1 the direction of the last passage, bit 2 set if a train is passing, bits 4..7 the passage
+  // counter (modulo 16). See REC_TRACK_INFO in AP_RS485_Lift_Ext.h
+  track_t &current = tracks[track];
+  return current.direction | ((current.state == PASSING) ? 0b100 : 0) | ((current.passages & 0x0F) << 4);
+}
+
+
+uint8_t TrainTracks::cmSpeed(uint8_t track) {
+  uint16_t cms = tracks[track].speed / 10;
+  return (cms > 255) ? 255 : cms;
+}
+
+
+// ***********************************************************************************************************
+void TrainTracks::estimate(track_t &track) {
+  // The first and last sensor of the track that have been blocked, in order of time
+  int8_t first = -1;
+  int8_t last = -1;
+  for (uint8_t k = 0; k < TRACK_SENSORS; k++) {
+    if (track.blockTime[k] == 0) continue;
+    if ((first < 0) || (track.blockTime[k] < track.blockTime[first])) first = k;
+    if ((last < 0) || (track.blockTime[k] >= track.blockTime[last])) last = k;
+  }
+  if ((first < 0) || (first == last) || (track.blockTime[first] == track.blockTime[last])) return;
+  // Sensor 0 of a track is the one farthest from the lift
+  track.direction = (first < last) ? INTO_LIFT : OUT_OF_LIFT;
+  unsigned long distance = (unsigned long)abs(last - first) * SENSOR_SPACING;
+  track.speed = (distance * 1000) / (track.blockTime[last] - track.blockTime[first]);
+}
+
+
+bool TrainTracks::inOrder(uint8_t t) {
+  // Sensor 0 of a track is the one farthest from the lift. A train into the lift frees sensor 0 first
+  track_t &track = tracks[t];
+  if (track.direction == UNKNOWN) return false;
+  unsigned long previous = 0;
+  for (uint8_t i = 0; i < TRACK_SENSORS; i++) {
+    uint8_t k = (track.direction == INTO_LIFT) ? i : (TRACK_SENSORS - 1 - i);
+    if (trackSensors[t][k] == 0) continue;
+    if (track.freeTime[k] == 0) return false;
+    if ((previous != 0) && (track.freeTime[k] <= previous)) return false;
+    previous = track.freeTime[k];
+  }
+  return true;
+}
+
+
+void TrainTracks::complete(track_t &track) {
+  track.passages++;
+  track.passed = true;
+}
+
+#endif
@@ -0,0 +1,80 @@
+// ***********************************************************************************************************
+// File:       Tracks.h
+// Author:     Aiko Pras
+// history:    2026-10-18 V1.0.0 ap initial version
+//
+// purpose:    Estimates direction and speed of trains that pass the IR sensors along a track, and detects
+//             when a train has fully passed.
+//
+// If several sensors are placed one after the other along the same track (see TRACKS in mySettings.h), the
+// order in which their beams become blocked tells the direction of a train, and the time between the first
+// and the last sensor its speed. update() is called after each scan; the time a sensor becomes blocked is
+// taken from the scan, thus the resolution equals SCAN_INTERVAL.
+//
+// The integrators free a sensor only after 10 scans with light (see IR-Sensor.h), which is conservative
+// since a single scan may see a reflection. A train that has fully passed however leaves evidence: its
+// tail frees the sensors one after the other, in the same order as its head blocked them. A track is
+// therefore clear before the integrators agree if:
+// - the train blocked all sensors of the track, thus its direction is known;
+// - the sensors became free (saw light after subtraction of ambient light, above minLight) in the order
+//   of that direction, each at least one scan after the previous one;
+// - all sensors saw light during the last FAST_CLEAR_SCANS scans, and
+// - the integrator of each sensor is below HIGH_TRESHOLD / 2, thus it saw light during most recent scans.
+// A train that stands across all sensors can not satisfy the order, even if all sensors see reflections
+// during the same scans. The sensors of a clear track are reported free to the Main Lift Controller, even
+// if their integrators did not yet reach LOW_TRESHOLD. In all other cases, for example if a train backed
+// out, the track only becomes clear once the integrators report all sensors free. If a sensor of a clear
+// track no longer sees light, a new passage starts.
+//
+// Per track the direction and speed of the last passage are reported to the Main Lift Controller, together
+// with a counter that is incremented after each passage, and (optional) via the RS-Bus.
+//
+// ***********************************************************************************************************
+#pragma once
+#include <Arduino.h>
+#include "mySettings.h"
+#include "IR-Sensor.h"
+#include <AP_RS485_Lift_Ext.h>       // For TRACK_RECORDS
+
+#if defined(TRACKS)
+
+#define FAST_CLEAR_SCANS 2           // Number of successive scans with light after which a track is clear
+
+#if (TRACKS < 1) || (TRACKS > TRACK_RECORDS)
+  #error "TRACKS should be 1..8 (see TRACK_RECORDS in AP_RS485_Lift_Ext.h)"
+#endif
+
+class TrainTracks {
+  public:
+    typedef enum {UNKNOWN, INTO_LIFT, OUT_OF_LIFT} direction_t;
+
+    TrainTracks();                       // Constructor for initialisation
+    void update();                       // Should be called after each scan
+    uint16_t released();                 // Sensors of clear tracks, which may be reported free
+    bool passed(uint8_t track);          // True once after a passage on the track has completed
+    direction_t direction(uint8_t track); // Direction of the last passage
+    uint16_t speed(uint8_t track);       // Speed (mm/s) of the last passage, 0 if unknown
+    uint8_t info(uint8_t track);         // Direction, passing and passage counter, for the master
+    uint8_t cmSpeed(uint8_t track);      // Speed (cm/s, max 255) of the last passage, for the master
+
+  private:
+    typedef enum {IDLE, PASSING, CLEAR} state_t;
+    struct track_t {
+      state_t state;
+      unsigned long blockTime[TRACK_SENSORS]; // Time (ms) each sensor became blocked, 0 if not yet
+      unsigned long freeTime[TRACK_SENSORS];  // Time (ms) each sensor saw light again, 0 if not (yet)
+      direction_t direction;             // Direction of the last (or current) passage
+      uint16_t speed;                    // Speed (mm/s) of the last (or current) passage
+      uint8_t passages;                  // Number of passages (modulo 256)
+      bool passed;                       // A passage completed, not yet handled by main
+    };
+    track_t tracks[TRACKS];
+    uint8_t lightScans[SCAN_SENSORS];    // Number of successive scans in which each sensor saw light
+    void estimate(track_t &track);       // Determines direction and speed from the block times
+    bool inOrder(uint8_t t);             // The sensors of track t became free in the order of its direction
+    void complete(track_t &track);       // Called once a passage has completed
+};
+
+extern TrainTracks trainTracks;
+
+#endif
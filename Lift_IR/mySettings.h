@@ -56,6 +56,8 @@
 //
 // To avoid the sensor from saturation, the burst of IR pulses may not become too long. 
 // Reasonable values are 15 to 30 pulses, which corresponds (roughly) to 375 us (15*25) till 750us.
+// The receivers are sampled twice per pulse, and at most 63 samples can be counted per burst.
+// These values may also be tuned per sensor, without uploading the sketch again (see Calibration.h).
 #define KHZ 25                       // Frequency at which we operate the IR system
 #define BURST_TIME 600               // Time in us the burst will last
 
@@ -79,7 +81,96 @@ const uint8_t RS_AddresHigh = 125;    // 1.. 128
 // This requires, however, that these GPIORs are not yet used elsewhere. 
 // The AP-DCC-Library, for example, already uses GPIOR0 and GPIOR1.
 // In case we also need the AP-DCC-Library, use the volatile uint8_t variables instead
-#define PORT GPIOR0                   // Fast, but may interfere with other libraries
-#define BITMASK GPIOR1                 
-//volatile uint8_t PORT;              // Slow, but more portable
-//volatile uint8_t BITMASK;
+// LEDS_LOW holds the IR-LEDs of sensors 1..8 (PORTF) that send a burst, LEDS_HIGH those of sensors 9..14
+// (PORTK).
+#define LEDS_LOW GPIOR0               // Fast, but may interfere with other libraries
+#define LEDS_HIGH GPIOR1                 
+//volatile uint8_t LEDS_LOW;          // Slow, but more portable
+//volatile uint8_t LEDS_HIGH;
+
+
+// 6) Second IR board
+// ==================
+// The Main Lift Controller supports a second IR board, for example for the far end of the lift
+// entrance. Its sensors are bits 16..31 of the IR masks of the Main Lift Controller. Enable the #define
+// below for the second board only, and set IR_BOARDS to 2 in the mySettings.h file of the Main Lift
+// Controller.
+// Use different RS-Bus addresses (see 4) for both boards.
+// #define SECOND_BOARD
+
+
+// 7) Scan groups
+// ==============
+// The sensors of a group are checked at the same time: their IR-LEDs send the burst together, and their
+// IR-receivers are checked together. Checking all sensors therefore takes (SCAN_GROUPS + 1) x BURST_TIME
+// (one extra burst to measure ambient light).
+// Only put sensors in the same group if the IR-LED of one sensor can not reach the IR-receiver of an
+// other sensor, for example because they are at opposite sides of the lift. Check a grouping with the
+// cross-talk test (see debugging mode in the README). Each group is a bitmap with the same layout as
+// MASK_SENSORS_CONNECTED. Sensors that are not part of any group are never checked.
+// The default puts each sensor in its own group, as earlier versions did. Example for two groups:
+// #define SCAN_GROUPS 2
+// const uint16_t scanGroups[SCAN_GROUPS] = {0b0000000001010101, 0b0000000010101010};
+#define SCAN_GROUPS 14
+const uint16_t scanGroups[SCAN_GROUPS] = {
+  0b0000000000000001, 0b0000000000000010, 0b0000000000000100, 0b0000000000001000,
+  0b0000000000010000, 0b0000000000100000, 0b0000000001000000, 0b0000000010000000,
+  0b0000000100000000, 0b0000001000000000, 0b0000010000000000, 0b0000100000000000,
+  0b0001000000000000, 0b0010000000000000};
+
+
+// 8) Scan interval
+// ================
+// The sensors are checked continuously, independent of the POLLs of the Main Lift Controller, which
+// are answered with the result of the last scan. A new scan is started every SCAN_INTERVAL ms (or as
+// soon as the previous scan has finished, if that takes longer). The integrators count scans: a beam
+// is blocked after 2 scans without light, and free again after 10 scans with a strong signal (20 scans
+// with a weak signal). With the default of 20ms, a blocked beam is therefore detected within 40ms, and
+// a free beam within 200ms (400ms for a weak signal).
+#define SCAN_INTERVAL 20              // Time in ms between the start of two scans
+
+
+// 9) Marginal sensors
+// ===================
+// The signal strength of each sensor is measured (see IR-Sensor.h). A sensor whose beam is free, but
+// whose signal is weak, is marginal: it may start to flap. Marginal sensors are shown in debugging mode.
+// If the #define below is enabled, marginal sensors are also reported via the RS-Bus, using two more
+// RS-Bus addresses (same layout as the sensor feedback: bit i is set if sensor i is marginal).
+// #define MARGINAL_FEEDBACK
+const uint8_t RS_AddresMarginalLow = 122;  // 1.. 128
+const uint8_t RS_AddresMarginalHigh = 123; // 1.. 128
+
+
+// 10) Sensor health
+// =================
+// The health of each sensor is tracked (see SensorHealth.h): sensors that are flapping, are stuck in
+// the blocked state, or never saw light. The results are shown in debugging mode. If the #define below
+// is enabled, sensors with one of these faults are also reported via the RS-Bus, using two more RS-Bus
+// addresses (bit i is set if sensor i is faulty).
+// #define HEALTH_FEEDBACK
+const uint8_t RS_AddresHealthLow = 120;    // 1.. 128
+const uint8_t RS_AddresHealthHigh = 121;   // 1.. 128
+
+
+// 11) Train direction and speed
+// =============================
+// If several sensors are placed one after the other along the same track (for example at the entrance
+// of the lift), the order and timing of their beam breaks give the direction and speed of a train (see
+// Tracks.h). The first sensor of each track is the one farthest from the lift; sensors are numbered
+// 1..14 as on the board, 0 means not used. SENSOR_SPACING is the distance (mm) between two successive
+// sensors of a track. Once a train has blocked all sensors of its track and its tail has freed them again
+// in the direction of travel, these sensors are reported free without waiting for the integrators.
+// Direction, speed and the number of passages are send to the Main Lift Controller. If TRACK_FEEDBACK
+// is enabled as well, the direction of the last passage is also reported via the RS-Bus: per track
+// (max 4) two bits, the first set if the train went into the lift, the second if it came out of it.
+// #define TRACKS 2
+#define TRACK_SENSORS 3
+#define SENSOR_SPACING 50
+#if defined(TRACKS)
+const uint8_t trackSensors[TRACKS][TRACK_SENSORS] = {
+  {1, 2, 3},                               // Track 1
+  {4, 5, 6}                                // Track 2
+};
+#endif
+// #define TRACK_FEEDBACK
+const uint8_t RS_AddresTracks = 119;       // 1.. 128
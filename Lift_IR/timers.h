@@ -2,6 +2,11 @@
 // File:       timers.h
 // Author:     Aiko Pras
 // history:    2023-12-31 V1.0.0 ap initial version
+//             2026-10-18 V1.1.0 ap the timer interrupts check the IR-receivers and step through all sensors
+//             2026-10-18 V1.2.0 ap a burst may include several IR-LEDs (scan groups)
+//             2026-10-18 V1.3.0 ap the samples with light are counted per IR-receiver (signal strength)
+//             2026-10-18 V1.4.0 ap each burst has its own carrier frequency and length
+//             2026-10-18 V1.5.0 ap receivers of other groups are counted as well (ambient light)
 // 
 // purpose:    Has all the low-level code to control generation of an IR-Beam
 //
@@ -21,6 +26,58 @@
 #define START_TIMER4 TCCR4B = (1<<WGM42) | (1<<CS40)
 #define START_TIMER5 TCCR5B = (1<<WGM52) | (1<<CS50)
 
+// State of the scan. A scan consists of a number of bursts; for each burst the IR-LEDs that send and the
+// IR-receivers that are checked are given by burstLeds[] and burstSensors[] (see IR-Sensor.cpp).
+// Shared between the ISRs and the IR_Sensors methods.
+#define MAX_BURSTS   32
+volatile uint16_t burstLeds[MAX_BURSTS];    // IR-LEDs that send during each burst
+volatile uint16_t burstSensors[MAX_BURSTS]; // IR-receivers that are checked during each burst
+volatile uint16_t burstDark[MAX_BURSTS];    // IR-receivers that are checked while their IR-LEDs are dark
+volatile uint16_t burstTop4[MAX_BURSTS];    // OCR4A (half period of the carrier) for each burst
+volatile uint16_t burstTop5[MAX_BURSTS];    // OCR5A (length) for each burst
+volatile uint8_t  scanBursts;        // Number of bursts of this scan
+volatile uint8_t  scanBurst;         // Burst that is currently being send
+volatile bool     scanBusy;          // A scan is in progress
+volatile bool     scanReady;         // A scan has completed, but the results are not yet used
+
+// The receivers are sampled twice per carrier period. To measure the strength of the IR signal, the
+// samples in which a receiver sees light are counted per receiver. A strong beam is detected after a few
+// periods and remains detected during the whole burst; a marginal beam is detected late or only now and
+// then. Counting per receiver in the ISR would take too long, therefore the counters are "vertical":
+// bit i of lightLow[n] / lightHigh[n] is bit n of the counter of receiver i (PINL) / i+8 (PINC). One
+// increment of all 8 counters of a port takes at most LIGHT_BITS AND/XOR operations.
+// At the end of each burst the Timer 5 ISR only copies the counters; they are converted into a count per
+// receiver by IR_Sensors::takeResult(), in the main loop, once all bursts have been send.
+#define LIGHT_BITS   6               // Counters up to 63 samples
+#define BURST_SAMPLES ((BURST_TIME * KHZ * 2) / 1000)
+#if BURST_SAMPLES > 63
+  #error "BURST_TIME is too long for the sample counters"
+#endif
+volatile uint8_t  lightLow[LIGHT_BITS];  // Vertical counters for IR-receivers 1..8 (PINL)
+volatile uint8_t  lightHigh[LIGHT_BITS]; // Vertical counters for IR-receivers 9..14 (PINC)
+volatile uint8_t  burstSamples;      // Number of samples during this burst
+volatile uint8_t  burstCounters[MAX_BURSTS][2 * LIGHT_BITS]; // Copy of lightLow and lightHigh per burst
+volatile uint8_t  burstSampled[MAX_BURSTS];  // Copy of burstSamples per burst
+
+// Selects the IR-LEDs and starts the burst.
+// Sensors 0..7 are connected to Ports F (LED) and L (receiver), sensors 8..13 to Ports K and C.
+inline void startBurst(uint8_t burst) {
+  LEDS_LOW = lowByte(burstLeds[burst]);
+  LEDS_HIGH = highByte(burstLeds[burst]);
+  for (uint8_t i = 0; i < LIGHT_BITS; i++) {
+    lightLow[i] = 0;
+    lightHigh[i] = 0;
+  }
+  burstSamples = 0;
+  OCR4A = burstTop4[burst];
+  OCR5A = burstTop5[burst];
+  TCNT4 = 0;
+  TCNT5 = 0;
+  START_TIMER4;
+  START_TIMER5;
+}
+
+
 // ***********************************************************************************************************
 // Initialise the timers
 // ***********************************************************************************************************
@@ -44,15 +101,41 @@ void IR_Sensors::init_timers() {
 // ***********************************************************************************************************
 // Timer ISRs
 // ***********************************************************************************************************
-// Timer 4 toggles the IR-LED.
+// Timer 4 toggles the IR-LEDs, and checks which IR-receivers see light (the receiver output is then LOW).
+// Checking once per half period of the carrier is sufficient, since the receiver output remains LOW
+// for several periods after it has detected the burst. All receivers are counted; the receivers that
+// belong to the burst are selected by the Timer 5 ISR.
 ISR(TIMER4_COMPA_vect) {
-  // Determine which port (PF or PK) and which bit to toggle (0..7)
-  if (PORT == LOW) PORTF ^=  BITMASK;
-    else PORTK ^=  BITMASK;
+  PORTF ^= LEDS_LOW;
+  PORTK ^= LEDS_HIGH;
+  uint8_t carryLow = ~PINL;          // Receivers that see light are incremented
+  uint8_t carryHigh = ~PINC;
+  for (uint8_t i = 0; (i < LIGHT_BITS) && (carryLow | carryHigh); i++) {
+    uint8_t bits = lightLow[i];
+    lightLow[i] = bits ^ carryLow;
+    carryLow &= bits;
+    bits = lightHigh[i];
+    lightHigh[i] = bits ^ carryHigh;
+    carryHigh &= bits;
+  }
+  burstSamples++;
 }
 
-// Timer 5 stops timer 4
+// Timer 5 ends the burst, stores the result and starts the next burst
 ISR(TIMER5_COMPA_vect) {
   STOP_TIMER4;
   STOP_TIMER5;
+  PORTF = 0;                         // Ensure all IR-LEDs are off
+  PORTK = 0;
+  for (uint8_t i = 0; i < LIGHT_BITS; i++) {
+    burstCounters[scanBurst][i] = lightLow[i];
+    burstCounters[scanBurst][LIGHT_BITS + i] = lightHigh[i];
+  }
+  burstSampled[scanBurst] = burstSamples;
+  scanBurst++;
+  if (scanBurst < scanBursts) startBurst(scanBurst);
+  else {
+    scanBusy = false;
+    scanReady = true;
+  }
 }
@@ -19,8 +19,37 @@
 // After the move is complete, the button Led will shortly light and subsequently dimm.
 // If a new position is being stored, the button LED will flash quickly
 //
-// If the lift is moving, we keep polling the button controller, but ignore all buttons except the RESET.
+// If the lift is moving, a short press of one of the 0..10 buttons will be queued. The associated
+// button Led will light, until the lift starts moving towards that level. 
+// Other buttons are ignored while the lift is moving, except the RESET.
 // If the RESET is pushed (short press), the lift will immediately be stopped (see emergence stop below).
+// After a RESET all queued requests are removed.
+//
+// Request queue
+// =============
+// Requests to move the lift, from buttons as well as DCC, are stored in a queue (see requests.h).
+// Requests that are received while the lift is moving are therefore no longer lost; they are 
+// dispatched as soon as the lift has arrived at its previous level. Repetitions of the same DCC
+// command are ignored. By default requests are served in order of arrival, but an elevator-like 
+// policy (LOOK) may be selected in mySettings.h. 
+//
+// Parking
+// =======
+// The lift learns which levels are requested after each other. If enabled (CV ParkDelay, see cvs.h
+// and mySettings.h), the lift moves after ParkDelay seconds of inactivity to the level that 
+// minimises the expected time for the next trip. A real request immediately cancels such move. 
+//
+// Occupancy
+// =========
+// The lift keeps track which levels hold a train (see occupancy.h). The map is updated once a train
+// crosses the IR beams at level 0, and optionally (OCCUPANCY_GUESS) once the lift leaves a storage level
+// after a request. The map can be changed via DCC or PoM. A DCC command moves the lift to the nearest
+// free level.
+//
+// Macros
+// ======
+// A complete sequence, such as a cassette exchange, can be started with a single DCC command. The
+// steps are executed locally and their progress is shown via the RS-Bus (see macros.h).
 //
 // DCC address
 // ===========
@@ -42,10 +71,11 @@
 // in combination with RS-Bus feedback.
 // Fortunately, we can still use DCC decoder addresses >=128, in combination with RS-Bus feedback, 
 // provided we select these addresses before compilation, in the file mySettings.h.
-// We use 12 feedback bits to inform traincontroller (or whatever software we have) at which level
-// the lift currently is (0..11). Additional feedback bits are used to signal that the stepper 
-// motors are IDLE (the lift has arrived at the requested level) and that no obstacles are detected
-// by the IR system. We therefore use 2 RS-Bus addresses. 
+// We use one feedback bit per level to inform traincontroller (or whatever software we have) at which
+// level the lift currently is (by default 0..11). Additional feedback bits are used to signal that the
+// stepper motors are IDLE (the lift has arrived at the requested level) and that no obstacles are 
+// detected by the IR system. With 12 levels we therefore use 2 RS-Bus addresses; more levels need
+// more RS-Bus addresses (see levels.h).
 //
 // Emergency stop
 // ==============
@@ -81,7 +111,7 @@
 //   Analysing this single bit may, in Train Control software, be easier than two bits.
 // During movement of the lift, all feedback bits are cleared.
 // Feedback is provided in two ways.
-// 1) Using the RS-Bus. We use two addresses; the meaning of the individual bits, is as follows:
+// 1) Using the RS-Bus. For 12 levels we use two addresses; the meaning of the bits is as follows:
 //   - Base address    : Level 0..7                (low and high nibble. Bit 0..7)
 //   - Base address + 1: Level 8..11               (low nibble.          Bit 0..3)
 //   - Base address + 1: IR-sensors are free       (high nibble          Bit 4)
@@ -109,12 +139,20 @@
 //*****************************************************************************************************
 #include <LiquidCrystal.h>        // Allow LCD output of the current state and position
 #include "mySettings.h"           // Allows user of this sketch to tailor the behaviour 
+#include "levels.h"               // Number of levels, DCC and RS-Bus addresses
 #include "hardware.h"             // Pins for LEDs, DCC input, RS-Bus output etc.
 #include "support.h"              // For the LCD Display and some on-board LEDs
 #include "rs485.h"                // Use RS485 to read IR-sensors. button status, set button LEDs 
 #include "stepper.h"              // Communication with the stepper motor controller (GRBL)
 #include "feedback.h"             // Feedback (RS-Bus) specific code
 #include "relays.h"               // For connecting two external relays 
+#include "requests.h"             // Queue of pending level requests
+#include "parking.h"              // Pre-positioning of the lift while it is idle
+#include "occupancy.h"            // Which levels hold a train
+#include "macros.h"               // Sequences of lift operations
+#include "irmask.h"               // The IR sensors that matter per level
+#include "cvs.h"                  // CVs specific for the Main Lift Controller
+#include "config.h"               // Copy in RAM of the CVs used in the main loop
 
 
 //*****************************************************************************************************
@@ -144,6 +182,24 @@ void mySettings() {
   #if defined(RS_ADDRESS)
     cvValues.write(myRSAddr, RS_ADDRESS);        // Default value = 0
   #endif
+  #if defined(PARK_DELAY)
+    cvValues.write(ParkDelay, PARK_DELAY);       // Default value = 0 (disabled)
+  #endif
+  #if defined(OCCUPANCY_GUESS)
+    cvValues.write(OccupancyGuess, 1);           // Default value = 0 (off)
+  #endif
+  #if defined(POLL_BUTTONS_IDLE)
+    cvValues.write(PollButtonsIdle, POLL_BUTTONS_IDLE);
+  #endif
+  #if defined(POLL_BUTTONS_ACTIVE)
+    cvValues.write(PollButtonsActive, POLL_BUTTONS_ACTIVE);
+  #endif
+  #if defined(POLL_IR_IDLE)
+    cvValues.write(PollIrIdle, POLL_IR_IDLE);
+  #endif
+  #if defined(POLL_IR_ACTIVE)
+    cvValues.write(PollIrActive, POLL_IR_ACTIVE);
+  #endif
 }
 
 
@@ -163,11 +219,16 @@ void setup() {
   // After cvValues.init() is called, CV default values may be modified using cvValues.defaults[...]
   cvValues.init(LiftDecoder,12);          // software version may be added as 2nd parameter. Default: 10  
   mySettings();                           // To override default settings with values from mySettings.h
+  config.load();                          // Copy the CVs used in the main loop to RAM
+  controllers.loadWeights();              // The RS485 poll weights
   decoderHardware.init();                 // Use the CV values stored in EEPROM
-  // The softare supports a maximum of 12 lift levels; each level has its own switch address.
-  // For 12 switch addresses, we need to listen to 3 decoder addresses
+  // Each lift level has its own switch address. For 12 switch addresses, we need to listen to 3 
+  // decoder addresses. Optionally one more decoder address is used for lift commands, another 3 to mark
+  // levels as occupied or free and one for macros. The number of decoder addresses follows from
+  // MAX_LEVEL, DCC_OCCUPANCY and DCC_MACROS (see levels.h)
   firstDecoderAddress = cvValues.storedAddress();
-  accCmd.setMyAddress(firstDecoderAddress, firstDecoderAddress + 2);
+  accCmd.setMyAddress(firstDecoderAddress, firstDecoderAddress + DCC_ADDRESSES - 1);
+  occupancy.load();
   // Initialise the feedback system. At start-up, the values for lift.level and lift.currentPosition 
   // are zero. The level bit and STEPPER_IDLE bit will be set. The RS-Bus master will be informed.
   feedback.init(cvValues.read(myRSAddr));
@@ -190,6 +251,12 @@ void setup() {
     Serial.println(firstDecoderAddress);   
     Serial.print("First RS-Bus address:"); 
     Serial.println(cvValues.read(myRSAddr)); 
+    Serial.print("Levels: ");
+    Serial.print(MAX_LEVEL);
+    Serial.print(", DCC decoder addresses: ");
+    Serial.print(DCC_ADDRESSES);
+    Serial.print(", RS-Bus addresses: ");
+    Serial.println(RS_ADDRESSES);
     Serial.print("IR-sensors: ");
     Serial.println(cvValues.read(IR_Detect));
     Serial.println(); 
@@ -206,10 +273,17 @@ void serialMonitor() {
   // - $$  = view settings
   // - x20 = Move X stepper to 20 mm
   // - ?   = status request
-  if (cvValues.read(Serial_Line)) {
+  // - &s  = show the RS485 counters, &r = reset them (not passed to GRBL, see rs485.h)
+  static bool rs485Command = false;
+  if (config.serialLine()) {
     if (Serial.available()) {
       char inByte = Serial.read();
-      Serial2.print(inByte);
+      if (rs485Command) {
+        controllers.command(inByte);
+        rs485Command = false;
+      }
+      else if (inByte == '&') rs485Command = true;
+      else GRBL_SERIAL.print(inByte);
     }
   }
 }
@@ -220,6 +294,8 @@ void serialMonitor() {
 //*****************************************************************************************************
 uint8_t level;
 bool dccReset = 0; 
+unsigned int dccMapTime;                     // Time (us) to map the last accessory command
+unsigned int maxDccMapTime = 0;              // Maximum time (us) to map an accessory command
 
 void loop() {
   // The main loop handles parses status and receices commands from:
@@ -230,6 +306,7 @@ void loop() {
   // - The DCC controller
   // The serial monitor, Button and DCC controller issue commands to move the steppers 
   // Feedback information is provided via the RS-Bus, LCD display and Button LEDs. 
+  loop_timer.update();
   
   //===================================================================================
   // Step 1: Serial monitor
@@ -252,7 +329,10 @@ void loop() {
     lcd_display.show();     // Show the buttonnumber and the stepper status
     if (stepper.state == grbl::IDLE) {
       digitalWrite(LED_BLUE, LOW);          // Indicate the steppers are idle
-      btn_cntrl.prepare_LED(LED_OFF, btn_cntrl.buttonNumber);  // buttonNumber: 0..13
+      // Switch off the LED of the level button whose request has been served. buttonNumber (0..13) may
+      // meanwhile be a queued request, whose LED should stay on
+      requests.arrived();
+      if (!requests.pending(btn_cntrl.buttonNumber)) btn_cntrl.prepare_LED(LED_OFF, btn_cntrl.buttonNumber);
       // Ensure that the lift position (in mm) matches the requested level.
       // In the (unlikely) case that only one of the two ATMega processors (2560 and 328)
       // performed a reset, both processors will be in different and thus inconsistent
@@ -260,9 +340,16 @@ void loop() {
       if (strcmp(lift.currentPosition,lift.positions[lift.level]) == 0) {
         feedback.setLiftLevel(lift.level);
         relaysCntrl.lift_idle(lift.level);  // if at level 0, switch the relays to POS1
-        if (cvValues.read(Serial_Line)) {
+        if (config.serialLine()) {
           Serial.print("Lift at level: ");
-          Serial.println(lift.currentPosition);
+          Serial.print(lift.currentPosition);
+          Serial.print(" - feedback mapping: ");
+          Serial.print(feedback.mapTime);
+          Serial.print("us (max ");
+          Serial.print(feedback.maxMapTime);
+          Serial.print("us), DCC mapping max: ");
+          Serial.print(maxDccMapTime);
+          Serial.println("us");
         }
       }      
       else {
@@ -272,6 +359,7 @@ void loop() {
     }
     else {
       feedback.clearFeedbackBits();         // to catch normal changes
+      occupancy.irChanged(true);            // Crossings only count while the lift stays at level 0
       digitalWrite(LED_BLUE, HIGH);         // Indicate the steppers are busy 
     }
   }
@@ -279,18 +367,44 @@ void loop() {
     lcd_display.show();
     relaysCntrl.lift_moving();              // Not at level 0, switch the relays to POS2
   }
+  //
+  // Once the lift has settled and the feedback for its level has been published,
+  // the oldest pending level request (if any) will be dispatched.
+  // If there are no requests for some time, the lift may move to the level where the next
+  // request is most likely expected. Real requests always take precedence over such move.
+  requests.update();
+  parking.update();
+  macros.update();
   //===================================================================================
   // Step 3: Send the IR-Sensor controller a poll message, and to the Button controller
   // a poll message or a command to change the button LEDs.
-  // The controller object send these messages over the RS-485 bus with 50ms intervals.
+  // The controller object sends the next message as soon as the previous one has been answered,
+  // or its timeout has expired (see rs485.h).
   controllers.talk485();
   // 
   //===================================================================================
   // Step 4: If the IR-Sensor controller changes state, send feedback via the RS-Bus
-  // sensorIsFree is a boolean variable, indicating if no IR-lightbeam is blocked
+  // Only the IR-lightbeams that matter for the current level are taken into account (see irmask.h)
   if (ir_cntrl.stateChanged()) {
-    feedback.irFree = ir_cntrl.sensorIsFree;
+    feedback.irFree = irMasks.free(lift.level);
     feedback.sendMainNibble();
+    controllers.measure(controllers.irLatency, ir_cntrl.changeTime);
+    occupancy.irChanged(irMasks.free(0));
+  }
+  // A train passed the IR sensors along one of the tracks (if the IR board has such sensors)
+  uint8_t irBoard, irTrack;
+  while (ir_cntrl.trainPassed(irBoard, irTrack)) {
+    if (!config.serialLine()) continue;
+    uint8_t direction = ir_cntrl.trackInfo[irBoard][irTrack] & 0b11;
+    Serial.print("IR board ");
+    Serial.print(irBoard + 1);
+    Serial.print(", track ");
+    Serial.print(irTrack + 1);
+    if (direction == 1) Serial.print(": train into the lift, ");
+      else if (direction == 2) Serial.print(": train out of the lift, ");
+      else Serial.print(": train passed, ");
+    Serial.print(ir_cntrl.trackSpeed[irBoard][irTrack]);
+    Serial.println(" cm/s");
   }
   //
   //===================================================================================
@@ -298,26 +412,24 @@ void loop() {
   // Did an event occur associated with a level button (buttons 0..10)
   // and is this not the button of the level we already are?  
   if (btn_cntrl.level_button_event()) {
-    if (stepper.state == grbl::IDLE) {
-      // Store the button number, to enable future display and LED-OFF messages  
-      lift.level = btn_cntrl.buttonNumber;
+    if (btn_cntrl.buttonAction == SHORTPRESS) {
+      // In case of a short press, the lift moves to the requested level. If the lift is still
+      // moving, the request waits in the queue. The request queue also takes care that the lift
+      // only moves if its position is not yet at the requested level.
+      if (requests.add(btn_cntrl.buttonNumber, request_queue::FROM_BUTTON)) {
+        if (!requests.settled()) btn_cntrl.prepare_LED(LED_ON, btn_cntrl.buttonNumber);
+      }
+      else if (requests.settled()) btn_cntrl.prepare_LED(LED_OFF, btn_cntrl.buttonNumber);
+    }
+    else if (requests.settled()) {
       // If the stepper motors are not moving, new commands can be accepted 
       if (btn_cntrl.buttonAction == PRESSED) {
         // Immediately after being pressed, put the associated LED on
-        btn_cntrl.prepare_LED(LED_ON, lift.level);
-      }
-      else if (btn_cntrl.buttonAction == SHORTPRESS) {
-        // In case of a short press, the lift moves to the requested level
-        // provided the lift's position is not yet at the requested level
-        if (strcmp(lift.currentPosition,lift.positions[lift.level])) {
-          lift.move(lift.level);
-          lcd_display.show();
-          btn_cntrl.prepare_LED(FLASH_SLOW, lift.level);
-        }
-        else btn_cntrl.prepare_LED(LED_OFF, lift.level);
+        btn_cntrl.prepare_LED(LED_ON, btn_cntrl.buttonNumber);
       }
       else if (btn_cntrl.buttonAction == LONGPRESS) {
         // The current position should be used and stored
+        lift.level = btn_cntrl.buttonNumber;
         strcpy(lift.positions[lift.level], lift.currentPosition);
         lift.storePosition(lift.level);
         btn_cntrl.prepare_LED(LED_OFF, lift.level);
@@ -349,6 +461,9 @@ void loop() {
    if (btn_cntrl.buttonAction == PRESSED) {
      switch (stepper.state) {
        case grbl::IDLE:
+         requests.clear();                  // Pending requests are no longer valid
+         macros.abort();
+         occupancy.leave();                 // We leave the current level
          feedback.clearFeedbackBits();      // We leave the IDLE state and the current level
          lift.level = 0;                    // This will become the new level
          btn_cntrl.prepare_LED(FLASH_SLOW, RESET_BUTTON);
@@ -358,6 +473,8 @@ void loop() {
        case grbl::RUN: 
        case grbl::JOG: 
        case grbl::HOLD: 
+         requests.clear();                  // Pending requests are no longer valid
+         macros.abort();
          reset_object.soft_reset(); 
          btn_cntrl.prepare_LED(FLASH_FAST, RESET_BUTTON);
        break;
@@ -398,25 +515,59 @@ void loop() {
         lcd_display.show();
       }
       break;
-      // Move the lift to the requested leve;
+      // Move the lift to the requested level. If the lift is still moving, the request is queued.
+      // The decoder addresses after those of the levels are used for commands, the occupancy map
+      // and macros (see levels.h).
+      // The time needed for mapping and handling the command is measured and shown on the monitor
       case Dcc::MyAccessoryCmd :
-        if (accCmd.command == Accessory::basic)
-        // If the stepper motors are inactive and the switch poition is '+', move the lift
-        if ((stepper.state == grbl::IDLE) && (accCmd.position == 1)) {
-          lift.level = (accCmd.decoderAddress - firstDecoderAddress) * 4 + accCmd.turnout - 1;
-          lift.move(lift.level);
-          if (cvValues.read(Serial_Line)) {
-            Serial.print("Move lift to level: ");
-            Serial.println(lift.level);
-          };
-          lcd_display.show();
+        if (accCmd.command == Accessory::basic) {
+          unsigned long start = micros();
+          uint8_t offset = accCmd.decoderAddress - firstDecoderAddress;
+          if (offset < DCC_LEVEL_ADDRESSES) {
+            // If the switch poition is '+', add the level to the request queue
+            // With the LOOK scheduler, position '-' adds a strict request that will not be reordered
+            level = offset * 4 + accCmd.turnout - 1;
+            if (accCmd.position == 1) requests.add(level, request_queue::FROM_DCC);
+            else if (requests.policy == request_queue::LOOK) requests.add(level, request_queue::FROM_DCC, true);
+          }
+          #if defined(DCC_OCCUPANCY)
+          else if (offset == DCC_COMMAND_OFFSET) {
+            // Switch 1, '+': store the train at the nearest free level
+            if ((accCmd.turnout == 1) && (accCmd.position == 1)) occupancy.store();
+          }
+          else if (offset < DCC_OCCUPANCY_END) {
+            // '+' marks the level as occupied, '-' as free
+            level = (offset - DCC_OCCUPANCY_OFFSET) * 4 + accCmd.turnout - 1;
+            if (accCmd.position == 1) occupancy.set(level);
+              else occupancy.clear(level);
+          }
+          #endif
+          #if defined(DCC_MACROS)
+          else if (offset == DCC_MACRO_OFFSET) {
+            // '+' starts macro 0..3, '-' aborts the running macro
+            if (accCmd.position == 1) macros.start(accCmd.turnout - 1);
+              else macros.abort();
+          }
+          #endif
+          dccMapTime = micros() - start;
+          if (dccMapTime > maxDccMapTime) maxDccMapTime = dccMapTime;
         }
       break;      
       case Dcc::MyPomCmd :
         cvProgramming.processMessage(Dcc::MyPomCmd);
+        config.load();                      // A CV used in the main loop may have been changed
+        controllers.loadWeights();
+        occupancy.load();                   // The occupancy map may have been changed
+        macros.program();                   // A macro step may have been changed
+        irMasks.program();                  // An IR mask may have been changed
         break;
       case Dcc::SmCmd :
         cvProgramming.processMessage(Dcc::SmCmd);
+        config.load();
+        controllers.loadWeights();
+        occupancy.load();
+        macros.program();
+        irMasks.program();
         break;
       default:
         break;
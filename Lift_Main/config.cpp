@@ -0,0 +1,33 @@
+/*******************************************************************************************************
+File:      config.cpp
+Author:    Aiko Pras
+History:   2026/10/18 Version 1.0
+
+
+Purpose:   Keeps a copy in RAM of the CVs that are used in the main loop
+
+******************************************************************************************************/
+#include <Arduino.h>
+#include <AP_DCC_Decoder_Core.h>     // For the CVs
+#include "config.h"
+#include "cvs.h"                     // For the ParkDelay CV
+
+
+// Instantiate the external object
+config_class  config;                // External object, used by main and others
+
+
+void config_class::load() {
+  serial = cvValues.read(Serial_Line);
+  ir = cvValues.read(IR_Detect);
+  lcd = cvValues.read(LCD_Display);
+  park = cvValues.read(ParkDelay);
+}
+
+
+#if defined(NO_CONFIG_CACHE) && !defined(FIXED_SETTINGS)
+uint8_t config_class::serialLine() { return cvValues.read(Serial_Line); }
+bool config_class::irDetect()      { return cvValues.read(IR_Detect); }
+bool config_class::lcdDisplay()    { return cvValues.read(LCD_Display); }
+uint8_t config_class::parkDelay()  { return cvValues.read(ParkDelay); }
+#endif
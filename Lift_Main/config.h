@@ -0,0 +1,82 @@
+/*******************************************************************************************************
+File:      config.h
+Author:    Aiko Pras
+History:   2026/10/18 Version 1.0
+
+
+Purpose:   Keeps a copy in RAM of the CVs that are used in the main loop.
+           Reading a CV via cvValues.read() takes considerably more time than reading a variable,
+           while some CVs (such as Serial_Line) are checked for every character received from GRBL.
+
+******************************************************************************************************/
+#pragma once
+#include <Arduino.h>
+#include "mySettings.h"
+
+
+/*****************************************************************************************************/
+// The config object holds a snapshot of the CVs below. The snapshot is loaded by main during setup,
+// and reloaded after every PoM or SM message that may have changed a CV. Code in the main loop
+// should therefore use config.serialLine() etc., instead of cvValues.read().
+//
+// If FIXED_SETTINGS is defined in mySettings.h, the values are no longer taken from the CVs, but
+// from mySettings.h. The methods below then return constants, which allows the compiler to remove
+// code that is never used, such as debugging output if SERIAL_MONITOR is not defined. In that case
+// these CVs can no longer be changed via PoM.
+// If NO_CONFIG_CACHE is defined, the methods call cvValues.read() each time, as previous versions
+// did. This allows the loop time (see support.h) to be compared with and without the snapshot.
+#if defined(FIXED_SETTINGS)
+  #if defined(SERIAL_MONITOR)
+    #define FIXED_SERIAL_LINE  SERIAL_MONITOR
+  #else
+    #define FIXED_SERIAL_LINE  0
+  #endif
+  #if defined(NO_IR_SENSORS)
+    #define FIXED_IR_DETECT    false
+  #else
+    #define FIXED_IR_DETECT    true
+  #endif
+  #if defined(ENABLE_LCD)
+    #define FIXED_LCD_DISPLAY  true
+  #else
+    #define FIXED_LCD_DISPLAY  false
+  #endif
+  #if defined(PARK_DELAY)
+    #define FIXED_PARK_DELAY   PARK_DELAY
+  #else
+    #define FIXED_PARK_DELAY   0
+  #endif
+#endif
+
+class config_class {
+  public:
+    void load();                         // Read the CVs. Called during setup and after PoM or SM
+
+    #if defined(FIXED_SETTINGS)
+    uint8_t serialLine() { return FIXED_SERIAL_LINE; }
+    bool irDetect()      { return FIXED_IR_DETECT; }
+    bool lcdDisplay()    { return FIXED_LCD_DISPLAY; }
+    uint8_t parkDelay()  { return FIXED_PARK_DELAY; }
+    #elif defined(NO_CONFIG_CACHE)
+    uint8_t serialLine();
+    bool irDetect();
+    bool lcdDisplay();
+    uint8_t parkDelay();
+    #else
+    uint8_t serialLine() { return serial; }
+    bool irDetect()      { return ir; }
+    bool lcdDisplay()    { return lcd; }
+    uint8_t parkDelay()  { return park; }
+    #endif
+
+  private:
+    uint8_t serial;                      // Serial_Line: 0 = off, 1 = basic, 2 = detailed
+    bool ir;                             // IR_Detect: the IR sensors are used
+    bool lcd;                            // LCD_Display: the LCD display is used
+    uint8_t park;                        // ParkDelay: seconds before parking, 0 or 255 = disabled
+};
+
+
+/*****************************************************************************************************/
+// Definition of external objects, which are declared in config.cpp but used by main and others
+extern config_class  config;
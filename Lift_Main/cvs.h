@@ -0,0 +1,35 @@
+/*******************************************************************************************************
+File:      cvs.h
+Author:    Aiko Pras
+History:   2026/10/18 Version 1.0
+
+
+Purpose:   Configuration Variables (CVs) that are specific for the Main Lift Controller.
+           The standard CVs, such as myAddrL, myRSAddr, IR_Detect and Serial_Line, are defined by the
+           AP_DCC_Decoder_Core library. The CVs below are not known by that library, but are read and
+           written in the same way: via cvValues.read() / cvValues.write(), via PoM, or by setting the
+           corresponding #define in mySettings.h.
+           CVs that have never been written hold 255 (erased EEPROM). The code that uses a CV below
+           should treat that value as "use the default".
+
+******************************************************************************************************/
+#pragma once
+
+
+#define ParkDelay     50    // Idle time (s) before the lift is pre-positioned. 0 or 255: disabled
+#define Occupied1     51    // Occupancy map: bit 0 = train on the lift, bit 1..7 = level 1..7
+#define Occupied2     52    // Occupancy map: level 8..15. The map uses one CV per 8 levels, thus
+                            // CV51..CV58 are reserved for up to 64 levels (see levels.h)
+#define OccupancyGuess 59   // 1: a train moves between the lift and a level visited by request
+#define MacroStep     60    // Macro step to be programmed: macro number * MAX_STEPS + step
+#define MacroOpcode   61    // Opcode of the step to be programmed (see macros.h)
+#define MacroArgument 62    // Argument of the step. Writing this CV stores the step
+#define PollButtonsIdle   63  // RS485 poll weight of the button controller, if idle (see rs485.h)
+#define PollButtonsActive 64  // Weight of the button controller, while buttons are used
+#define PollIrIdle        65  // Weight of the IR controller, if idle
+#define PollIrActive      66  // Weight of the IR controller, around loading at level 0
+#define IrMaskLow         67  // IR sensors 0..7 that matter for the level below (see irmask.h)
+#define IrMaskHigh        68  // IR sensors 8..15 that matter for that level
+#define IrMaskLevel       69  // Level of the mask. Writing this CV stores the mask
+#define IrMaskLow2        70  // With two IR boards: sensors 0..7 of the second board for that level
+#define IrMaskHigh2       71  // Sensors 8..15 of the second board
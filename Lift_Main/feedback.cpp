@@ -11,6 +11,8 @@ Purpose:   Implements feedback via the RS-Bus interface and the onboard (blue) c
 #include <Arduino.h>
 #include "stepper.h"          // Needed to get direct access to the stepper state and lift position
 #include "feedback.h"
+#include "config.h"           // For the IR_Detect CV
+#include "irmask.h"           // For the IR sensors that matter at the level
 
 
 // Instantiate the feedback object
@@ -19,22 +21,34 @@ Purpose:   Implements feedback via the RS-Bus interface and the onboard (blue) c
 feedbackController   feedback;
 
 
-// Instantiate the two RS-bus objects that send feedback messages regarding the state of the lift.
+// Instantiate the RS-bus objects that send feedback messages regarding the state of the lift.
 // The first object uses the "base RS-Bus address", as stored in myRSAddr (CV10). 
-// The second object uses an address one higher (myRSAddr + 1);
-RSbusConnection rsbus1;                      // RS-Bus object for level 0..7
-RSbusConnection rsbus2;                      // RS-Bus object for level 8..10, plus ready, moving etc.
-uint8_t feedbackData1 = 0;                   // The feedback data for the first rsbus object (rsbus1)
-uint8_t feedbackData2 = 0;                   // The feedback data for the second rsbus object (rsbus2)
+// The next objects use the next addresses (myRSAddr + 1, ...). See levels.h for the layout.
+RSbusConnection rsbus[RS_ADDRESSES];         // RS-Bus objects for the levels, plus ready, moving etc.
+uint8_t feedbackData[RS_ADDRESSES];          // The feedback data for each rsbus object
+RSbusConnection rsbusMacro;                  // RS-Bus object for the progress of macros
+uint8_t macroData = 0;                       // The feedback data for rsbusMacro
 
 
 void feedbackController::init(uint8_t address) {
-  if ((address >= 1) && (address <= 126)) {
-    rsbus1.address = address;                // Minimum value is 1
-    rsbus2.address = address + 1;            // Maximum value is 127 (128 is reserved for PoM)
+  // Minimum value is 1. Maximum value is 127 (128 is reserved for PoM)
+  // If there is no room for the macro address, the progress of macros is not published.
+  if ((address >= 1) && ((address + RS_ADDRESSES - 1) <= 127)) {
+    for (uint8_t i = 0; i < RS_ADDRESSES; i++) rsbus[i].address = address + i;
+    if ((address + RS_MACRO_OFFSET) <= 127) rsbusMacro.address = address + RS_MACRO_OFFSET;
+    else if (cvValues.read(Serial_Line)) {
+      Serial.print("Warning: RS-Bus address ");
+      Serial.print(address + RS_MACRO_OFFSET);
+      Serial.println(" for macro progress is out of range (1..127); progress is not published");
+    }
   } 
+  for (uint8_t i = 0; i < RS_ADDRESSES; i++) feedbackData[i] = 0;
   irFree = false;                            // We only announce FREE if this has been checked
   liftAtLevel = false;                       // Same here
+  status = 0;
+  onboardLevels = 0;
+  mapTime = 0;
+  maxMapTime = 0;
   // We manupulate the feedback ports directly, since that is trivial
   DDRC = 0xFF;     // PORTC: All outputs
   DDRL = 0xFF;     // PORTL: All outputs
@@ -47,78 +61,85 @@ void feedbackController::init(uint8_t address) {
 
 
 void feedbackController::sendMainNibble() {
+  // The status nibble is the high nibble of the last RS-Bus address
   uint8_t nibble;
   nibble = (liftAtLevel << RS_STEPPER_IDLE);
-  if (cvValues.read(IR_Detect)) {
+  if (config.irDetect()) {
     nibble |= (irFree << RS_IR_FREE);
     if (irFree && liftAtLevel) nibble |= (1 << RS_LIFT_READY);
   }
   else if (liftAtLevel) nibble |= (1 << RS_LIFT_READY);  
-  rsbus2.send4bits(HighBits, nibble);
-  feedbackData2 = (nibble << 4) + (feedbackData2 & 0b00001111);
-  PORTC = feedbackData2;
-  PORTF = (feedbackData2 >> 7);  // Only the Lift Ready bit
+  rsbus[RS_ADDRESSES - 1].send4bits(HighBits, nibble);
+  feedbackData[RS_ADDRESSES - 1] = (nibble << 4) + (feedbackData[RS_ADDRESSES - 1] & 0b00001111);
+  status = nibble;
+  setPorts();
 }
 
 
 void feedbackController::setLiftLevel(uint8_t level) {
   // Main calls setLiftLevel if the stepper state is IDLE and the level has been double checked
-  uint8_t nibble = 0;
-  switch (level) {
-    case 0: 
-    case 1:
-    case 2:
-    case 3:
-      bitSet(nibble, level);
-      rsbus1.send4bits(LowBits, nibble);
-      feedbackData1 = nibble;
-    break;
-    case 4: 
-    case 5:
-    case 6:
-    case 7:
-      bitSet(nibble, level - 4);
-      rsbus1.send4bits(HighBits, nibble);
-      feedbackData1 = (nibble << 4);
-    break;
-    case 8: 
-    case 9:
-    case 10:
-      bitSet(nibble, level - 8);
-      rsbus2.send4bits(LowBits, nibble);
-      feedbackData2 = nibble;
-    break;
+  // The IR sensors that matter may differ per level (see irmask.h)
+  // The RS-Bus address, nibble and bit follow from the level number (see levels.h).
+  unsigned long start = micros();
+  if (level < MAX_LEVEL) {
+    uint8_t index = level / 8;
+    uint8_t nibble = (1 << (level % 4));
+    for (uint8_t i = 0; i < RS_ADDRESSES; i++) feedbackData[i] &= (i == RS_ADDRESSES - 1) ? 0xF0 : 0;
+    if ((level / 4) % 2) {
+      rsbus[index].send4bits(HighBits, nibble);
+      feedbackData[index] |= (nibble << 4);
+    }
+    else {
+      rsbus[index].send4bits(LowBits, nibble);
+      feedbackData[index] |= nibble;
+    }
+    onboardLevels = (level < ONBOARD_LEVELS) ? (1 << level) : 0;
   }
   liftAtLevel = true;
-  PORTL = feedbackData1;
-  PORTC = feedbackData2;
+  irFree = irMasks.free(level);
+  mapTime = micros() - start;
+  if (mapTime > maxMapTime) maxMapTime = mapTime;
   sendMainNibble();
 }
 
 
 void feedbackController::clearFeedbackBits() {
-  uint8_t nibble;
-  nibble = (feedbackData1 & 0b00001111);
-  if (nibble != 0) rsbus1.send4bits(LowBits, 0);
-  nibble = (feedbackData1 & 0b11110000);
-  if (nibble != 0) rsbus1.send4bits(HighBits, 0);
-  nibble = (feedbackData2 & 0b00001111);
-  if (nibble != 0) rsbus2.send4bits(LowBits, 0);
-  feedbackData1 = 0;
-  feedbackData2 = 0;
-  PORTL = 0;
-  PORTC = 0;
-  PORTF = 0;
+  // Only nibbles holding the bit of a level are cleared; the status nibble is send below.
+  for (uint8_t i = 0; i < RS_ADDRESSES; i++) {
+    if (feedbackData[i] & 0b00001111) rsbus[i].send4bits(LowBits, 0);
+    if ((i < RS_ADDRESSES - 1) && (feedbackData[i] & 0b11110000)) rsbus[i].send4bits(HighBits, 0);
+    feedbackData[i] = 0;
+  }
+  onboardLevels = 0;
   liftAtLevel = false;
   sendMainNibble();
 }
 
 
+void feedbackController::setMacroProgress(uint8_t data) {
+  // Only nibbles that changed are send
+  if ((data & 0b00001111) != (macroData & 0b00001111)) rsbusMacro.send4bits(LowBits, data & 0b00001111);
+  if ((data & 0b11110000) != (macroData & 0b11110000)) rsbusMacro.send4bits(HighBits, data >> 4);
+  macroData = data;
+}
+
+
 void feedbackController::update() {
   // update is called by main at the end of every loop
   // As frequent as possible we should check if the RS-Bus asks for the most recent feedback data.
-  if (rsbus1.feedbackRequested) rsbus1.send8bits(feedbackData1);
-  if (rsbus2.feedbackRequested) rsbus2.send8bits(feedbackData2);
-  rsbus1.checkConnection();
-  rsbus2.checkConnection();
+  for (uint8_t i = 0; i < RS_ADDRESSES; i++) {
+    if (rsbus[i].feedbackRequested) rsbus[i].send8bits(feedbackData[i]);
+    rsbus[i].checkConnection();
+  }
+  if (rsbusMacro.feedbackRequested) rsbusMacro.send8bits(macroData);
+  rsbusMacro.checkConnection();
+}
+
+
+void feedbackController::setPorts() {
+  // The onboard connectors IN 1..8 (PORTL) are for level 0..7, IN 9..12 (PORTC low nibble) for 
+  // level 8..11, IN 13..14 (PORTC high nibble) for the status bits and OUT 1 (PORTF) for lift ready
+  PORTL = onboardLevels & 0xFF;
+  PORTC = (status << 4) | ((onboardLevels >> 8) & 0b00001111);
+  PORTF = (status >> RS_LIFT_READY);         // Only the Lift Ready bit
 }
@@ -12,6 +12,7 @@ Purpose:   Implements RS-Bus interface
 ******************************************************************************************************/
 #pragma once
 #include <AP_DCC_Decoder_Core.h>      // Library for a basic DCC accesory decoder with RS-Bus feedback
+#include "levels.h"                   // For the number of RS-Bus addresses
 
 
 #define RS_IR_FREE      0             // Bit number 0 of second nibble (HighBits)    
@@ -20,23 +21,34 @@ Purpose:   Implements RS-Bus interface
 
 
 //******************************************** RS-BUS CONTROLLER **************************************
-// The RS-BUS controller sets the appropriate feedback bits of the two RS-Bus channels being used. 
+// The RS-BUS controller sets the appropriate feedback bits of the RS-Bus channels being used. 
+// The number of RS-Bus channels (RS_ADDRESSES) depends on the number of levels; see levels.h for the
+// location of the bit of each level. For analysis purposes, the time needed to map a level to its
+// bit and send the feedback is measured.
 class feedbackController {
   public:
-    void init(uint8_t address);       // Sets the two RS-Bus addresses
+    void init(uint8_t address);       // Sets the RS-Bus addresses
     void sendMainNibble();            // Send the bits for IR free, stepper idle and lift ready
     void setLiftLevel(uint8_t level); // Set the RS-Bus bits that corresponds to the current level 
     void clearFeedbackBits();         // Clear all RS-Bus bit corresponding to the lift level and state
+    void setMacroProgress(uint8_t data); // Set the bits of the macro RS-Bus address (see macros.h)
     void update();                    // Called at the end of the Main loop as frequent as possible
-    bool irFree;                      // To indicate if the IR sensors are free or occupied 
+    bool irFree;                      // To indicate if the IR sensors of the level are free or occupied 
     bool liftAtLevel;                 // To indicate if the lift arrived at the expected level 
+    unsigned int mapTime;             // Time (us) the last setLiftLevel() took
+    unsigned int maxMapTime;          // Maximum time (us) setLiftLevel() took
+
+  private:
+    uint8_t status;                   // The status nibble: IR free, stepper idle and lift ready
+    uint16_t onboardLevels;           // Bit for the onboard connector of level 0..11 
+    void setPorts();                  // Sets the onboard feedback connectors
 };
 
 //*****************************************************************************************************
 // Definition of external objects, which are declared in feedback.cpp but used by main 
 extern feedbackController   feedback;
 
-extern RSbusConnection rsbus1;                // RS-Bus object for level 0..7
-extern RSbusConnection rsbus2;                // RS-Bus object for level 8..10, plus ready, moving etc.
-extern uint8_t feedbackData1;                 // feedback data for rsbus1 / IN 1..8
-extern uint8_t feedbackData2;                 // feedback data for rsbus2 / IN 9..14 / OUT 1..3
+extern RSbusConnection rsbus[RS_ADDRESSES];   // RS-Bus objects for the levels, plus ready, moving etc.
+extern uint8_t feedbackData[RS_ADDRESSES];    // feedback data for the rsbus objects
+extern RSbusConnection rsbusMacro;            // RS-Bus object for the progress of macros
+extern uint8_t macroData;                     // feedback data for rsbusMacro
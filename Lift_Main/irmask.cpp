@@ -0,0 +1,84 @@
+/*******************************************************************************************************
+File:      irmask.cpp
+Author:    Aiko Pras
+History:   2026/10/18 Version 1.0
+
+
+Purpose:   Holds per lift level the IR sensors that matter for entering or leaving that level
+
+******************************************************************************************************/
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <AP_DCC_Decoder_Core.h>     // For the CVs
+#include "irmask.h"
+#include "stepper.h"                 // For the EEPROM layout
+#include "parking.h"                 // For the EEPROM layout
+#include "macros.h"                  // For the EEPROM layout
+#include "rs485.h"                   // For the state of the IR sensors
+#include "cvs.h"                     // For the IR mask programming CVs
+#include "config.h"                  // For the Serial_Line CV
+
+
+// Instantiate the external object
+ir_mask_class  irMasks;              // External object, used by main and others
+
+
+//*****************************************************************************************************
+//********************************* External Methods for IR Masks *************************************
+//*****************************************************************************************************
+ir_mask_class::ir_mask_class() {
+  // The masks are stored just below the macros (see macro_engine::macro_engine()).
+  // The character before the masks tells if the masks have been initialised.
+  EpromStart = EEPROM.length() - (MAX_LEVEL * NUMBER_LENGHT) - 2 - (PARK_ROWS * MAX_LEVEL) - 1
+               - (MAX_MACROS * MAX_STEPS * 2) - 1 - (MAX_LEVEL * sizeof(ir_bits_t));
+  if (EEPROM.read(EpromStart - 1) != 0b01010111) {
+    for (uint8_t i = 0; i < MAX_LEVEL; i++) masks[i] = IR_MASK_DEFAULT;
+    EEPROM.put(EpromStart, masks);
+    EEPROM.update(EpromStart - 1, 0b01010111);
+  }
+  else EEPROM.get(EpromStart, masks);
+}
+
+
+void ir_mask_class::program() {
+  // Called after PoM and SM. A mask is stored once its level has been written.
+  uint8_t level = cvValues.read(IrMaskLevel);
+  if (level == 255) return;
+  if (level < MAX_LEVEL) {
+    masks[level] = cvValues.read(IrMaskLow) | ((ir_bits_t)cvValues.read(IrMaskHigh) << 8);
+    #if (IR_BOARDS > 1)
+    masks[level] |= ((ir_bits_t)cvValues.read(IrMaskLow2) << 16) | ((ir_bits_t)cvValues.read(IrMaskHigh2) << 24);
+    #endif
+    EEPROM.put(EpromStart + (level * sizeof(ir_bits_t)), masks[level]);
+    show(level);
+  }
+  cvValues.write(IrMaskLevel, 255);
+}
+
+
+ir_bits_t ir_mask_class::mask(uint8_t level) {
+  if (level >= MAX_LEVEL) return IR_ALL_BLOCKED; // Unknown level: all sensors matter
+  return masks[level];
+}
+
+
+bool ir_mask_class::free(uint8_t level) {
+  return ((ir_cntrl.blocked & mask(level)) == 0);
+}
+
+
+bool ir_mask_class::free(uint8_t from, uint8_t to) {
+  return ((ir_cntrl.blocked & (mask(from) | mask(to))) == 0);
+}
+
+
+//*****************************************************************************************************
+//********************************* Internal Methods for IR Masks *************************************
+//*****************************************************************************************************
+void ir_mask_class::show(uint8_t level) {
+  if (!config.serialLine()) return;
+  Serial.print("IR mask level ");
+  Serial.print(level);
+  Serial.print(": ");
+  Serial.println(masks[level], BIN);
+}
@@ -0,0 +1,58 @@
+/*******************************************************************************************************
+File:      irmask.h
+Author:    Aiko Pras
+History:   2026/10/18 Version 1.0
+
+
+Purpose:   Holds per lift level the IR sensors that matter for entering or leaving that level.
+           Earlier versions reduced all IR sensors to a single free / busy bit. A train that blocked
+           the beam of a track that is not aligned with the current level therefore delayed every
+           move, as well as the LIFT_READY feedback. 
+
+******************************************************************************************************/
+#pragma once
+#include <Arduino.h>
+#include "levels.h"                  // For MAX_LEVEL
+#include "rs485.h"                   // For IR_BOARDS and ir_bits_t
+
+
+/*****************************************************************************************************/
+// The IR board reports a bitmap with one bit per sensor (see rs485.h). For each level a mask tells which
+// of these sensors are relevant: bit i set means that a blocked beam of sensor i should stop the lift
+// from entering or leaving that level. With two IR boards (IR_BOARDS), the masks have 32 bits: bit
+// 16 + i stands for sensor i of the second board. free(level) is true if none of the relevant beams is blocked.
+// For a move, the sensors of the level the lift leaves and of the level it moves to are relevant.
+// The masks are used for:
+// - the IR_FREE and LIFT_READY bits on the RS-Bus (for the level the lift is at),
+// - the dispatch of requests by the request queue (see requests.h),
+// - the WAIT_IR_FREE and WAIT_TRAIN steps of macros (see macros.h),
+// - the train crossings at level 0 for the occupancy map (see occupancy.h).
+//
+// The masks are stored in EEPROM, just below the macros. If the EEPROM has not been initialised, all
+// masks are set to IR_MASK_DEFAULT (mySettings.h), or to all ones (all sensors matter, as before).
+// A mask can be changed via PoM: write the low byte (sensor 0..7) to CV IrMaskLow, the high byte
+// (sensor 8..15) to CV IrMaskHigh, with two IR boards the sensors of the second board to IrMaskLow2
+// and IrMaskHigh2, and finally the level to CV IrMaskLevel. Once the level is written, the mask is
+// stored and IrMaskLevel is set back to 255.
+#if !defined(IR_MASK_DEFAULT)
+  #define IR_MASK_DEFAULT     IR_ALL_BLOCKED // All sensors matter for all levels
+#endif
+
+class ir_mask_class {
+  public:
+    ir_mask_class();                     // Constructor for initialisation. Checks the EEPROM
+    void program();                      // Should be called after PoM, to store a changed mask
+    ir_bits_t mask(uint8_t level);       // The sensors that matter for this level
+    bool free(uint8_t level);            // True if none of the relevant sensors is blocked
+    bool free(uint8_t from, uint8_t to); // Same, for a move between both levels
+
+  private:
+    ir_bits_t masks[MAX_LEVEL];          // Copy in RAM of the masks in EEPROM
+    uint16_t EpromStart;                 // EEPROM address of the mask of level 0
+    void show(uint8_t level);            // Show the mask on the serial monitor
+};
+
+
+/*****************************************************************************************************/
+// Definition of external objects, which are declared in irmask.cpp but used by main and others
+extern ir_mask_class  irMasks;
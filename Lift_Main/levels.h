@@ -0,0 +1,83 @@
+/*******************************************************************************************************
+File:      levels.h
+Author:    Aiko Pras
+History:   2026/10/18 Version 1.0
+
+
+Purpose:   Derives, from the number of lift levels, all sizes that depend on that number: the number
+           of DCC decoder addresses, the number of RS-Bus addresses and the size of the tables in
+           RAM and EEPROM. The number of levels itself is set in mySettings.h (LIFT_LEVELS).
+
+******************************************************************************************************/
+#pragma once
+#include "mySettings.h"
+
+
+/*****************************************************************************************************/
+// Level 0 is used for arriving and departing trains. The other levels can be used to store trains.
+// Originally the lift supported 12 levels (0..11); this is still the default.
+#if !defined(LIFT_LEVELS)
+  #define LIFT_LEVELS       12
+#endif
+#if (LIFT_LEVELS < 2) || (LIFT_LEVELS > 64)
+  #error "LIFT_LEVELS should be between 2 and 64"
+#endif
+#define MAX_LEVEL           LIFT_LEVELS      // The number of levels the lift can move to
+#if !defined(LEVEL_DISTANCE)
+  #define LEVEL_DISTANCE    100.0            // Default distance (mm) between levels above 11
+#endif
+
+
+/*****************************************************************************************************/
+// DCC: each decoder address has four switches. Each level has its own switch; the first decoder
+// addresses therefore select the levels. If DCC_OCCUPANCY is defined in mySettings.h, the next decoder
+// address is used for lift commands (see occupancy.h), followed by the same number of decoder addresses
+// to mark levels as occupied or free. If DCC_MACROS is defined, one more decoder address starts the
+// macros (see macros.h). For 12 levels, with both defined, this gives:
+//   Decoder address + 0..2: move to level 0..11
+//   Decoder address + 3   : lift commands
+//   Decoder address + 4..6: occupancy of level 0..11
+//   Decoder address + 7   : macros
+// Without these #defines the decoder only listens to the addresses for the levels (+ 0..2), as before.
+// The level that belongs to a switch is: (decoder address offset * 4) + switch - 1
+#define DCC_LEVEL_ADDRESSES  ((MAX_LEVEL + 3) / 4)
+#if defined(DCC_OCCUPANCY)
+  #define DCC_COMMAND_OFFSET   DCC_LEVEL_ADDRESSES
+  #define DCC_OCCUPANCY_OFFSET (DCC_COMMAND_OFFSET + 1)
+  #define DCC_OCCUPANCY_END    (DCC_OCCUPANCY_OFFSET + DCC_LEVEL_ADDRESSES)
+#else
+  #define DCC_OCCUPANCY_END    DCC_LEVEL_ADDRESSES
+#endif
+#if defined(DCC_MACROS)
+  #define DCC_MACRO_OFFSET     DCC_OCCUPANCY_END
+  #define DCC_ADDRESSES        (DCC_MACRO_OFFSET + 1)
+#else
+  #define DCC_ADDRESSES        DCC_OCCUPANCY_END
+#endif
+
+
+/*****************************************************************************************************/
+// RS-Bus: each RS-Bus address has eight feedback bits, which are send as two nibbles. Each level has
+// its own bit. The levels fill the nibbles in order, starting with the low nibble of the first RS-Bus
+// address. The status bits (IR free, lift at level, lift ready) are always in the high nibble of the
+// last RS-Bus address. One more RS-Bus address shows the progress of macros (see macros.h).
+// For 12 levels this gives:
+//   RS-Bus address + 0: level 0..7
+//   RS-Bus address + 1: level 8..11 (low nibble) and status (high nibble)
+//   RS-Bus address + 2: macro progress
+// The RS-Bus address of a level is level / 8; the nibble is (level / 4) % 2; the bit is level % 4.
+// The onboard connectors (IN 1..12) only exist for levels 0..11.
+#define RS_LEVEL_NIBBLES     ((MAX_LEVEL + 3) / 4)
+#define RS_ADDRESSES         ((RS_LEVEL_NIBBLES + 2) / 2)
+#define RS_MACRO_OFFSET      RS_ADDRESSES
+#define ONBOARD_LEVELS       12
+
+
+/*****************************************************************************************************/
+// RAM and EEPROM use grows linearly with the number of levels:
+// - Lift positions: MAX_LEVEL * NUMBER_LENGHT bytes in RAM and EEPROM (see stepper.h)
+// - Parking table:  2 * MAX_LEVEL bytes in RAM and EEPROM (see parking.h)
+// - Macros:         a fixed number of bytes in EEPROM (see macros.h)
+// - IR masks:       2 * MAX_LEVEL bytes in RAM and EEPROM, 4 * MAX_LEVEL with two IR boards (see irmask.h)
+// - Occupancy map:  one CV (and byte of RAM) per 8 levels (see occupancy.h)
+#define OCCUPANCY_BYTES      ((MAX_LEVEL + 7) / 8)
@@ -0,0 +1,220 @@
+/*******************************************************************************************************
+File:      macros.cpp
+Author:    Aiko Pras
+History:   2026/10/18 Version 1.0
+
+
+Purpose:   Executes sequences of lift operations ("macros") locally on the Main Lift Controller
+
+******************************************************************************************************/
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <AP_DCC_Decoder_Core.h>     // For the CVs
+#include "macros.h"
+#include "stepper.h"                 // For the lift level and the EEPROM layout
+#include "requests.h"                // To move the lift
+#include "occupancy.h"               // For the nearest free level
+#include "parking.h"                 // For the EEPROM layout
+#include "feedback.h"                // To check arrival and publish the progress
+#include "irmask.h"                  // For the state of the IR sensors that matter for the level
+#include "cvs.h"                     // For the macro programming CVs
+#include "config.h"                  // For the Serial_Line and IR_Detect CVs
+
+
+// Instantiate the external object
+macro_engine  macros;                // External object, used by main
+
+
+//*****************************************************************************************************
+//********************************** External Methods for Macros **************************************
+//*****************************************************************************************************
+macro_engine::macro_engine() {
+  active = false;
+  progress = 0;
+  macroStart = 0;
+  runs = 0;
+  errors = 0;
+  lastDuration = 0;
+  // The macros are stored just below the parking table (see parking_class::parking_class()).
+  // The character before the macros tells if the macros have been initialised.
+  EpromStart = EEPROM.length() - (MAX_LEVEL * NUMBER_LENGHT) - 2 - (PARK_ROWS * MAX_LEVEL) - 1
+               - (MAX_MACROS * MAX_STEPS * 2);
+  if (EEPROM.read(EpromStart - 1) != 0b01010101) {
+    const uint8_t exchange[][2] = {{MOVE, ARG_FREE}, {WAIT_IR_FREE, 30}, {FEEDBACK, 1},
+                                   {WAIT_TRAIN, 120}, {FEEDBACK, 0}, {RETURN, 0}};
+    for (uint16_t i = 0; i < (MAX_MACROS * MAX_STEPS * 2); i++) EEPROM.update(EpromStart + i, END);
+    for (uint8_t i = 0; i < 6; i++) {
+      EEPROM.update(EpromStart + (i * 2), exchange[i][0]);
+      EEPROM.update(EpromStart + (i * 2) + 1, exchange[i][1]);
+    }
+    EEPROM.update(EpromStart - 1, 0b01010101);
+  }
+}
+
+
+void macro_engine::start(uint8_t number) {
+  // DCC command stations repeat accessory commands; these repetitions are ignored.
+  if (active || (number >= MAX_MACROS)) return;
+  if ((macroStart != 0) && ((millis() - macroStart) < DUPLICATE_WINDOW)) return;
+  macro = number;
+  for (uint8_t i = 0; i < MAX_STEPS; i++) {
+    steps[i][0] = EEPROM.read(EpromStart + (((macro * MAX_STEPS) + i) * 2));
+    steps[i][1] = EEPROM.read(EpromStart + (((macro * MAX_STEPS) + i) * 2) + 1);
+  }
+  startLevel = lift.level;
+  index = 0;
+  active = true;
+  macroStart = millis();
+  progress = (1 << MACRO_RUNNING);
+  if (config.serialLine()) {
+    Serial.print("Start macro: ");
+    Serial.println(macro);
+  }
+  beginStep();
+}
+
+
+void macro_engine::abort() {
+  if (active) finish(false);
+}
+
+
+void macro_engine::update() {
+  // Should be called from main as often as possible, after the request queue has been updated.
+  // Several steps may finish within a single call, for example a FEEDBACK step.
+  while (active && stepDone()) {
+    index++;
+    beginStep();
+  }
+}
+
+
+void macro_engine::program() {
+  // Called after PoM and SM. A step is stored once its argument has been written.
+  uint8_t argument = cvValues.read(MacroArgument);
+  if (argument == 255) return;
+  uint8_t step = cvValues.read(MacroStep);
+  if (step < (MAX_MACROS * MAX_STEPS)) {
+    EEPROM.update(EpromStart + (step * 2), cvValues.read(MacroOpcode));
+    EEPROM.update(EpromStart + (step * 2) + 1, argument);
+    cvValues.write(MacroStep, step + 1);
+  }
+  cvValues.write(MacroArgument, 255);
+}
+
+
+bool macro_engine::running() {
+  return active;
+}
+
+
+//*****************************************************************************************************
+//********************************** Internal Methods for Macros **************************************
+//*****************************************************************************************************
+void macro_engine::beginStep() {
+  if (index >= MAX_STEPS) {
+    finish(true);
+    return;
+  }
+  uint8_t opcode = steps[index][0];
+  uint8_t argument = steps[index][1];
+  stepStart = millis();
+  progress = (progress & 0b11110000) | (index + 1);
+  switch (opcode) {
+    case MOVE:
+    case RETURN:
+      if (opcode == RETURN) target = startLevel;
+        else if (argument == ARG_FREE) target = occupancy.nearestFree();
+        else target = argument;
+      if (target >= MAX_LEVEL) {
+        finish(false);
+        return;
+      }
+      // Strict requests are not reordered by the LOOK scheduler. If the request is refused, since
+      // the lift just went to that level, stepDone() finds the lift already there.
+      requests.add(target, request_queue::FROM_DCC, true);
+    break;
+    case WAIT_TRAIN:
+      blocked = false;
+    break;
+    case FEEDBACK:
+      if (argument) progress |= (1 << MACRO_READY);
+        else progress &= ~(1 << MACRO_READY);
+    break;
+    case END:
+      finish(true);
+      return;
+    default:
+    break;
+  }
+  publish();
+}
+
+
+bool macro_engine::stepDone() {
+  uint8_t argument = steps[index][1];
+  bool irUsed = config.irDetect();
+  switch (steps[index][0]) {
+    case MOVE:
+    case RETURN:
+      if (requests.settled() && !requests.pending(target) && feedback.liftAtLevel
+          && (lift.level == target)) return true;
+      if (timedOut(MACRO_MOVE_TIMEOUT)) finish(false);
+      return false;
+    case WAIT_IR_FREE:
+      if (!irUsed || irMasks.free(lift.level)) return true;
+      if (timedOut(argument)) finish(false);
+      return false;
+    case WAIT_TRAIN:
+      if (!irUsed) return ((millis() - stepStart) >= (argument * 1000UL));
+      if (!irMasks.free(lift.level)) blocked = true;
+      else if (blocked) return true;
+      if (timedOut(argument)) finish(false);
+      return false;
+    case DELAY:
+      return ((millis() - stepStart) >= (argument * 100UL));
+    default:
+      return true;
+  }
+}
+
+
+bool macro_engine::timedOut(uint8_t seconds) {
+  return ((seconds != 0) && ((millis() - stepStart) >= (seconds * 1000UL)));
+}
+
+
+void macro_engine::finish(bool completed) {
+  active = false;
+  progress &= ~((1 << MACRO_RUNNING) | 0b00001111);
+  if (completed) {
+    runs++;
+    lastDuration = millis() - macroStart;
+    progress |= (1 << MACRO_DONE);
+    progress &= ~(1 << MACRO_ERROR);
+  }
+  else {
+    errors++;
+    progress |= (1 << MACRO_ERROR);
+    progress &= ~(1 << MACRO_DONE);
+  }
+  publish();
+  if (config.serialLine()) {
+    Serial.print("Macro ");
+    Serial.print(macro);
+    if (completed) {
+      Serial.print(" done in: ");
+      Serial.print(lastDuration);
+      Serial.println("ms");
+    }
+    else {
+      Serial.print(" aborted at step: ");
+      Serial.println(index + 1);
+    }
+  }
+}
+
+
+void macro_engine::publish() {
+  feedback.setMacroProgress(progress);
+}
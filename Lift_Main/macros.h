@@ -0,0 +1,100 @@
+/*******************************************************************************************************
+File:      macros.h
+Author:    Aiko Pras
+History:   2026/10/18 Version 1.0
+
+
+Purpose:   Executes sequences of lift operations ("macros"), such as a complete cassette exchange,
+           locally on the Main Lift Controller.
+           Without macros, the train control software has to send a DCC command for every step and
+           poll the RS-Bus feedback to see if that step has finished. Each such round trip adds
+           seconds to the exchange. A macro is started with a single DCC accessory command.
+
+******************************************************************************************************/
+#pragma once
+#include <Arduino.h>
+
+
+/*****************************************************************************************************/
+// A macro consists of up to MAX_STEPS steps. Each step has an opcode and an argument:
+// - MOVE         : Move the lift to the level in the argument. If the argument is ARG_FREE, the lift
+//                  moves to the nearest free level (see occupancy.h). The step ends once the lift
+//                  has arrived. The level where the macro started is remembered for RETURN.
+// - WAIT_IR_FREE : Wait till the IR sensors that matter for the current level (see irmask.h) are
+//                  free. Argument: timeout in seconds (0: no timeout)
+// - WAIT_TRAIN   : Wait till these IR sensors are blocked and subsequently free again, thus till a
+//                  train has passed. Argument: timeout in seconds (0: no timeout).
+//                  Without IR sensors, this step waits the number of seconds in the argument.
+// - DELAY        : Wait. Argument: time in tenths of seconds.
+// - FEEDBACK     : Argument 1 sets the READY bit on the RS-Bus (to signal the train may move),
+//                  argument 0 clears it.
+// - RETURN       : Move the lift back to the level where the macro started.
+// - END          : The macro is complete. Unused steps hold END.
+// If a step does not finish in time (for MOVE and RETURN: MACRO_MOVE_TIMEOUT), the macro is aborted
+// and the ERROR bit is set. The RESET button and switch position '-' also abort the macro.
+//
+// The macros are stored in EEPROM, just below the parking table. If the EEPROM has not been
+// initialised, macro 0 is set to a cassette exchange at the nearest free level:
+//   MOVE ARG_FREE, WAIT_IR_FREE 30, FEEDBACK 1, WAIT_TRAIN 120, FEEDBACK 0, RETURN, END
+// Steps can be changed via PoM: write the number of the step (macro * MAX_STEPS + step) to CV
+// MacroStep, the opcode to CV MacroOpcode and finally the argument to CV MacroArgument. Once the
+// argument is written, the step is stored and MacroStep is incremented, so the next step can follow.
+//
+// The macros are started via the DCC macro decoder address, if DCC_MACROS is defined (see levels.h):
+// switch 1..4, position '+', starts macro 0..3. The progress is published via the macro RS-Bus address:
+// - Bit 0..3: the number (1..MAX_STEPS) of the step being executed, 0 if no macro runs
+// - Bit 4   : RUNNING - a macro is being executed
+// - Bit 5   : READY   - set and cleared by the FEEDBACK step
+// - Bit 6   : ERROR   - the last macro has been aborted
+// - Bit 7   : DONE    - the last macro has completed
+// If the Serial_Line CV is set, the duration of each macro is shown on the serial monitor.
+#define MAX_MACROS          4            // Number of macros
+#define MAX_STEPS           12           // Maximum number of steps per macro (below 16)
+#define ARG_FREE            254          // MOVE argument: the nearest free level
+#define MACRO_MOVE_TIMEOUT  120          // Time (s) a MOVE or RETURN step may take
+
+#define MACRO_RUNNING       4            // Bit numbers of the macro RS-Bus address
+#define MACRO_READY         5
+#define MACRO_ERROR         6
+#define MACRO_DONE          7
+
+class macro_engine {
+  public:
+    typedef enum {END, MOVE, WAIT_IR_FREE, WAIT_TRAIN, DELAY, FEEDBACK, RETURN} opcode_t;
+
+    macro_engine();                      // Constructor for initialisation. Checks the EEPROM
+    void start(uint8_t number);          // Start the macro with this number
+    void abort();                        // Stop the running macro (after a RESET)
+    void update();                       // Should be called from main as often as possible
+    void program();                      // Should be called after PoM, to store a changed step
+    bool running();
+
+    // Statistics
+    uint16_t runs;                       // Number of completed macros
+    uint16_t errors;                     // Number of aborted macros
+    unsigned long lastDuration;          // Time (ms) the last completed macro took
+
+  private:
+    uint8_t steps[MAX_STEPS][2];         // Opcode and argument of the running macro
+    uint8_t macro;                       // Number of the running macro
+    uint8_t index;                       // Index of the current step
+    uint8_t startLevel;                  // Level at which the macro started
+    uint8_t target;                      // Level of the current MOVE or RETURN step
+    bool blocked;                        // WAIT_TRAIN: the IR sensors have been blocked
+    bool active;                         // A macro is being executed
+    uint8_t progress;                    // The bits published on the RS-Bus
+    unsigned long macroStart;            // Time (millis) the macro started
+    unsigned long stepStart;             // Time (millis) the current step started
+    uint16_t EpromStart;                 // Start address of the macros in EEPROM
+
+    void beginStep();                    // Perform the actions at the start of a step
+    bool stepDone();                     // True if the current step has finished
+    bool timedOut(uint8_t seconds);      // True if the current step takes too long
+    void finish(bool completed);
+    void publish();                      // Send the progress via the RS-Bus
+};
+
+
+/*****************************************************************************************************/
+// Definition of external objects, which are declared in macros.cpp but used by main
+extern macro_engine  macros;
@@ -47,11 +47,31 @@ Purpose:   Allow users of this sketch to select the board (SMD or THT) and tailo
 // #define SERIAL_MONITOR 1
 
 
+// The settings above (IR sensors, LCD, serial monitor) and PARK_DELAY are stored in CVs, and may
+// therefore be changed via PoM. If FIXED_SETTINGS is defined, the values in this file are used instead
+// of the CVs. The compiler then removes all code that can not be used, such as debugging output if
+// SERIAL_MONITOR is not defined, which makes the main loop faster. Changes via PoM have no effect.
+// NO_CONFIG_CACHE is only meant for measurements: the CVs are then read each time they are needed, 
+// instead of once after start-up and after every PoM message. With SERIAL_MONITOR 2, the mean and
+// maximum loop time are displayed every 10 seconds.
+// #define FIXED_SETTINGS
+// #define NO_CONFIG_CACHE
+
+
+// By default, the status of the GRBL controller is requested once per second with a '?', and GRBL
+// answers with a human readable (ASCII) status report. If GRBL has been built with the binary status
+// report option (see extras/Board-xxx/04-GRBL-and-steppers), uncomment the #define below. GRBL will
+// then answer with a small binary frame, which is parsed much faster and polled ten times per second.
+// GRBL_STEPS_PER_MM should have the same value as the GRBL setting $100 (X steps/mm).
+// #define GRBL_BINARY_STATUS
+#define GRBL_STEPS_PER_MM 80.0
+
+
 // The decoder can listen to DCC accessory commands to move the lift to a certain level.
 // Each lift level has its own switch address; the first switch address is for level 0;
 // the second switch address is for level 1, the third for level 2, etc.
-// Per 4 switch addresses we need one decoder address. Since the maximum number of lift levels is 12,
-// we listen to three decoder addresses.
+// Per 4 switch addresses we need one decoder address. With the default of 12 lift levels, we listen to
+// three decoder addresses (plus those enabled by DCC_OCCUPANCY and DCC_MACROS below).
 // The first decoder address is stored in CV1 plus CV9. The relationship between CV1, CV9 
 // and the decoder address is explained in RCN-213 (Section 2.1) and RCN-225.
 // - the valid range for CV1 is 1..63 (if CV9 == 0) or 0..63 (if CV9 !=0)
@@ -65,15 +85,81 @@ Purpose:   Allow users of this sketch to select the board (SMD or THT) and tailo
 #define CV1 56
 #define CV9 3
 
+// Optionally the decoder listens to more decoder addresses, directly after those for the levels. With
+// 12 levels, DCC_OCCUPANCY adds decoder address + 3 (lift commands, such as store the train at the
+// nearest free level) and + 4..6 (mark levels as occupied or free), and DCC_MACROS adds one more
+// decoder address to start macros (+ 7, or + 3 without DCC_OCCUPANCY). Make sure these addresses are
+// not used by other decoders on your layout. See levels.h for details.
+// #define DCC_OCCUPANCY
+// #define DCC_MACROS
+
+// The occupancy map (CV51 and up) is updated once a train crosses the IR beams at level 0, and via
+// DCC (see above) or PoM. If OCCUPANCY_GUESS is defined, it is also assumed that a train moves between
+// the lift and a storage level once the lift has been send there by a request. That assumption is wrong
+// if the lift only passes or visits a level without moving a train, thus the default is off.
+// The value is stored in CV59 (OccupancyGuess): 0 = off, 1 = on.
+// #define OCCUPANCY_GUESS
+
 
 // The RS-Bus address is stored in CV10 (myRSAddr). Valid addresses are between 1..128. 
 // The default value is 0, meaning that the RSbus becomes inactive. 
 // The RS-Bus address 128 is used by all my decoders for PoM feedback. 
 // We need two RS-Bus addresses for all feedback information; only the first address
 // needs to be entered below. This address should therefore be between 1..126.
+// The progress of macros uses the next address, which is only available if this address is 1..125.
 #define RS_ADDRESS 126
 
 
+// Requests to move the lift, received via DCC or the level buttons, are queued while the lift moves.
+// By default, queued requests are served in order of arrival (FIFO). Uncomment the #define below to
+// serve them like an elevator (LOOK): the lift first serves all requested levels in its current 
+// direction of travel, before it reverses. This reduces the travel distance if several requests 
+// are pending. With LOOK enabled, a DCC accessory command with position '-' (instead of '+') 
+// requests a "strict" move, which will not be reordered with respect to other requests.
+// #define SCHEDULER_LOOK
+
+
+// After a trip the lift stays at the last level. If PARK_DELAY is defined, the lift learns which levels
+// are requested after each other and, after PARK_DELAY seconds of inactivity, moves to the level 
+// where the next request is most likely expected. Real requests immediately cancel such move.
+// The value is stored in CV50 (ParkDelay), and can therefore also be changed via PoM. 
+// Values: 0 = disabled, 1..254 = number of seconds.
+// #define PARK_DELAY 60
+
+
+// The RS485 bus time is shared between the button and IR controllers. A controller that is in use
+// (buttons while jogging, IR sensors around loading at level 0) gets more polls, according to the
+// weights below. The share of a controller equals its weight, divided by the sum of both weights.
+// The values are stored in CV63..CV66, and can therefore also be changed via PoM. Default: 1 and 4.
+// #define POLL_BUTTONS_IDLE    1
+// #define POLL_BUTTONS_ACTIVE  4
+// #define POLL_IR_IDLE         1
+// #define POLL_IR_ACTIVE       4
+
+
+// The RS485 bus may hold a second button panel and a second IR board. The second panel and board
+// should enable SECOND_PANEL, resp. SECOND_BOARD, in the mySettings.h file of their own sketch.
+// The sensors of the second board are bits 16..31 of the IR masks below. LEDs are only shown on the
+// first panel.
+// #define BUTTON_PANELS 2
+// #define IR_BOARDS 2
+
+
+// For each level a mask tells which IR sensors (bit i = sensor i) matter for entering or leaving that
+// level; blocked beams of other sensors are ignored for that level (see irmask.h). The masks are stored
+// in EEPROM; the value below is only used if the EEPROM has not been initialised. Later changes can be
+// made via PoM (CV67..CV71). With two IR boards, bits 16..31 stand for the sensors of the second board.
+// Default: all sensors matter for all levels.
+// #define IR_MASK_DEFAULT 0xFFFF
+
+
+// For testing the RS485 polling without the button and IR controllers, the bus and both controllers
+// can be simulated on this board (see simbus.h). A built-in scenario presses buttons and blocks IR
+// beams; the latencies are shown by typing '&s' on the serial monitor. The GRBL commands are discarded
+// and nothing is stored in EEPROM, but never enable this on a real lift.
+// #define SIMULATE_SLAVES
+
+
 // Pins for external relays. They must be somewhere on the OUT 9..14 pins (Port K):
 #define RELAY1_POS1    63  // PIN_PK1 - Number on PCB: OUT 10
 #define RELAY1_POS2    64  // PIN_PK2 - Number on PCB: OUT 11 
@@ -81,6 +167,13 @@ Purpose:   Allow users of this sketch to select the board (SMD or THT) and tailo
 #define RELAY2_POS2    66  // PIN_PK4 - Number on PCB: OUT 13 
 
 
+// The number of lift levels, including level 0. The default is 12 levels (0..11); the maximum is 64. 
+// The number of DCC decoder addresses and RS-Bus addresses grows with the number of levels; see 
+// levels.h for details. Note that the button panel has buttons for levels 0..10 only, and the 
+// onboard feedback connectors exist for levels 0..11 only. Higher levels can only be selected via DCC.
+#define LIFT_LEVELS 12
+
+
 // Initial lift positions. Will be entered into EEPROM if and only if the EEPROM has not been initialised.
 // Once the EEPROM is initialised, values will not be written to EEPROM again, even if you make changes 
 // here. Later changes regarding lift positions should be made via the buttons. In case you don't have
@@ -99,6 +192,8 @@ Purpose:   Allow users of this sketch to select the board (SMD or THT) and tailo
 #define LEVEL09     "900.000"
 #define LEVEL10    "1000.000"
 #define LEVEL11    "1100.000"
+// If there are more than 12 levels, each next level is LEVEL_DISTANCE mm above the previous one.
+#define LEVEL_DISTANCE 100.0
 
 // Set the #define below to 1, if the new values MUST be written to EEPROM. Don't forget to change it
 // back to 0 once the new settings are stored, to avoid EEPROM wear-out.
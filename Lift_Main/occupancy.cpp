@@ -0,0 +1,171 @@
+/*******************************************************************************************************
+File:      occupancy.cpp
+Author:    Aiko Pras
+History:   2026/10/18 Version 1.0
+
+
+Purpose:   Keeps track which of the storage levels hold a train
+
+******************************************************************************************************/
+#include <Arduino.h>
+#include <AP_DCC_Decoder_Core.h>     // For the CVs
+#include "occupancy.h"
+#include "stepper.h"                 // For the lift positions
+#include "requests.h"                // To request the move to a free level
+#include "feedback.h"                // To check if the lift is at a known level
+#include "parking.h"                 // For LIFT_SPEED and LIFT_START_TIME
+#include "cvs.h"                     // For the Occupied1 and OccupancyGuess CVs
+#include "config.h"                  // For the Serial_Line CV
+
+
+// Instantiate the external object
+occupancy_class  occupancy;          // External object, used by main and the request queue
+
+
+//*****************************************************************************************************
+//******************************** External Methods for Occupancy *************************************
+//*****************************************************************************************************
+occupancy_class::occupancy_class() {
+  memset(map, 0, sizeof(map));
+  visiting = NO_LEVEL;
+  guess = false;
+  irBusy = false;
+  lastStore = 0;
+}
+
+
+void occupancy_class::load() {
+  // CVs that have never been written hold 255. If all CVs hold 255, or bits are set for levels
+  // that do not exist, the map has not been initialised yet.
+  guess = (cvValues.read(OccupancyGuess) == 1);
+  if (!guess) visiting = NO_LEVEL;
+  bool initialised = false;
+  for (uint8_t i = 0; i < OCCUPANCY_BYTES; i++) {
+    map[i] = cvValues.read(Occupied1 + i);
+    if (map[i] != 255) initialised = true;
+  }
+  if ((MAX_LEVEL % 8) && (map[OCCUPANCY_BYTES - 1] >> (MAX_LEVEL % 8))) initialised = false;
+  if (!initialised) {
+    memset(map, 0, sizeof(map));
+    save();
+  }
+}
+
+
+void occupancy_class::set(uint8_t level) {
+  if (level >= MAX_LEVEL) return;
+  if (occupied(level)) return;
+  map[level / 8] |= (1 << (level % 8));
+  save();
+}
+
+
+void occupancy_class::clear(uint8_t level) {
+  if (level >= MAX_LEVEL) return;
+  if (!occupied(level)) return;
+  map[level / 8] &= ~(1 << (level % 8));
+  save();
+}
+
+
+bool occupancy_class::occupied(uint8_t level) {
+  return (map[level / 8] & (1 << (level % 8)));
+}
+
+
+void occupancy_class::irChanged(bool sensorIsFree) {
+  // Only crossings at level 0, while the lift is idle, are relevant.
+  bool atLevel0 = (feedback.liftAtLevel && (lift.level == 0));
+  if (!atLevel0) {
+    irBusy = false;
+    return;
+  }
+  if (!sensorIsFree) irBusy = true;
+  else if (irBusy) {
+    // A train has crossed the IR beams. If the lift was empty, it entered. Otherwise it left.
+    irBusy = false;
+    if (occupied(0)) clear(0);
+      else set(0);
+  }
+}
+
+
+void occupancy_class::visit(uint8_t level) {
+  if (!guess) return;                      // Only IR crossings and DCC / PoM commands change the map
+  if (level == visiting) return;           // The lift does not move
+  leave();
+  if (level > 0) visiting = level;         // At level 0 the IR sensors are used instead
+}
+
+
+void occupancy_class::leave() {
+  if (visiting == NO_LEVEL) return;
+  bool onLift = occupied(0);
+  bool atLevel = occupied(visiting);
+  if (onLift && !atLevel) {
+    clear(0);
+    set(visiting);
+  }
+  else if (!onLift && atLevel) {
+    clear(visiting);
+    set(0);
+  }
+  visiting = NO_LEVEL;
+}
+
+
+bool occupancy_class::store() {
+  // DCC command stations repeat accessory commands. Since the first command already added the
+  // selected level to the queue, a repetition would select the next free level.
+  if ((lastStore != 0) && ((millis() - lastStore) < DUPLICATE_WINDOW)) return false;
+  lastStore = millis();
+  uint8_t best = nearestFree();
+  if (config.serialLine()) {
+    Serial.print("Store train at level: ");
+    if (best == NO_LEVEL) Serial.println("none free");
+      else Serial.println(best);
+  }
+  if (best == NO_LEVEL) return false;
+  return requests.add(best, request_queue::FROM_DCC);
+}
+
+
+uint8_t occupancy_class::nearestFree() {
+  // Select the free level, not yet in the request queue, with the shortest estimated trip time
+  float current = atof(lift.currentPosition);
+  uint8_t best = NO_LEVEL;
+  unsigned long bestTime = 0;
+  for (uint8_t i = 1; i < MAX_LEVEL; i++) {
+    if (occupied(i) || requests.pending(i)) continue;
+    float distance = fabs(atof(lift.positions[i]) - current);
+    unsigned long time = LIFT_START_TIME + (unsigned long)(distance * 1000 / LIFT_SPEED);
+    if ((best == NO_LEVEL) || (time < bestTime)) {
+      best = i;
+      bestTime = time;
+    }
+  }
+  return best;
+}
+
+
+//*****************************************************************************************************
+//******************************** Internal Methods for Occupancy *************************************
+//*****************************************************************************************************
+void occupancy_class::save() {
+  for (uint8_t i = 0; i < OCCUPANCY_BYTES; i++) cvValues.write(Occupied1 + i, map[i]);
+  show();
+}
+
+
+void occupancy_class::show() {
+  if (!config.serialLine()) return;
+  Serial.print("Occupied levels:");
+  for (uint8_t i = 0; i < MAX_LEVEL; i++) {
+    if (occupied(i)) {
+      Serial.print(" ");
+      if (i == 0) Serial.print("lift");
+        else Serial.print(i);
+    }
+  }
+  Serial.println();
+}
@@ -0,0 +1,71 @@
+/*******************************************************************************************************
+File:      occupancy.h
+Author:    Aiko Pras
+History:   2026/10/18 Version 1.0
+
+
+Purpose:   Keeps track which of the storage levels hold a train, and selects the nearest free
+           level for storing the next train.
+           Without such map, the train control software has to remember which levels are occupied,
+           and must decide itself to which level a newly arriving train should be moved.
+
+******************************************************************************************************/
+#pragma once
+#include <Arduino.h>
+#include "levels.h"                  // For MAX_LEVEL and the DCC address offsets
+
+
+/*****************************************************************************************************/
+// The occupancy map is a bitmap with one bit per level. Since level 0 connects the lift to the layout
+// and can not be used for storage, bit 0 tells if a train is on the lift itself.
+// The map is stored in one CV per 8 levels (Occupied1 and higher, see cvs.h), and is therefore
+// retained after a restart. It can be read and modified via PoM, and modified via DCC accessory commands.
+//
+// The map is also updated automatically:
+// - At level 0 a train enters or leaves the lift. While the lift is at level 0, each time the IR
+//   beams go from busy to free a train has crossed. If the lift was empty, the train entered the
+//   lift; if the lift held a train, the train left the lift.
+// - At the other levels no IR sensors exist. Only if CV OccupancyGuess is 1 (see OCCUPANCY_GUESS in
+//   mySettings.h), it is assumed that the train moves between the lift and a level the lift is send
+//   to by a request. Once the lift leaves that level again, the train is moved in the map from the
+//   lift to the level (if only the lift was occupied) or from the level to the lift (if only the level
+//   was occupied). A lift that only visits a level without moving a train corrupts the map, thus
+//   this assumption is off by default.
+// The DCC and PoM commands allow the map to be corrected.
+//
+// DCC accessory commands, if DCC_OCCUPANCY is defined (relative to the first decoder address, see
+// levels.h; for 12 levels):
+// - Decoder address + 3, switch 1, '+': move the lift to the nearest free level (store)
+// - Decoder address + 4..6: '+' marks level 0..11 as occupied, '-' marks it as free
+// The nearest free level is the free storage level, not yet in the request queue, with the shortest
+// estimated trip time (see parking.h for the estimate).
+#define NO_LEVEL              255            // The lift is not at a level that was requested
+
+class occupancy_class {
+  public:
+    uint8_t map[OCCUPANCY_BYTES];        // Bit 0: train on the lift, bit n: train at level n
+
+    occupancy_class();                   // Constructor for initialisation
+    void load();                         // Read the map from the CVs. Should be called after PoM
+    void set(uint8_t level);             // Mark the level as occupied
+    void clear(uint8_t level);           // Mark the level as free
+    bool occupied(uint8_t level);
+    void irChanged(bool sensorIsFree);   // Called by main once the IR sensors change state
+    void visit(uint8_t level);           // Called by the request queue if the lift will move to level
+    void leave();                        // Called once the lift leaves the current level
+    bool store();                        // Move the lift to the nearest free level. False if none
+    uint8_t nearestFree();               // The nearest free level, or NO_LEVEL
+
+  private:
+    uint8_t visiting;                    // Requested level the lift is currently at, or NO_LEVEL
+    bool guess;                          // OccupancyGuess: trains move to / from visited levels
+    bool irBusy;                         // The IR beams were busy while the lift was at level 0
+    unsigned long lastStore;             // Time (millis) of the last store command
+    void save();                         // Write the map to the CVs
+    void show();                         // Show the map on the serial monitor
+};
+
+
+/*****************************************************************************************************/
+// Definition of external objects, which are declared in occupancy.cpp but used by main
+extern occupancy_class  occupancy;
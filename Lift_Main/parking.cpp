@@ -0,0 +1,225 @@
+/*******************************************************************************************************
+File:      parking.cpp
+Author:    Aiko Pras
+History:   2026/10/18 Version 1.0
+
+
+Purpose:   Predictive pre-positioning ("parking") of the lift while it is idle
+
+******************************************************************************************************/
+#include <Arduino.h>
+#include <EEPROM.h>
+#include "parking.h"
+#include "stepper.h"                 // To move the lift and check the stepper state
+#include "requests.h"                // To check for pending requests
+#include "feedback.h"                // To check if the lift is at a known level
+#include "occupancy.h"               // The lift leaves its level
+#include "macros.h"                  // No parking while a macro runs
+#include "cvs.h"                     // For the ParkDelay CV
+#include "config.h"                  // For the Serial_Line and ParkDelay CVs
+#include "irmask.h"                  // No parking while a train blocks the IR beams
+
+
+// Instantiate the external object
+parking_class  parking;              // External object, used by main and the request queue
+
+
+//*****************************************************************************************************
+//********************************* External Methods for Parking **************************************
+//*****************************************************************************************************
+parking_class::parking_class() {
+  lastRequest = MAX_LEVEL;                   // No level has been requested yet
+  tableChanged = false;
+  parkState = IDLE;
+  idleSince = 0;
+  parks = 0;
+  expectedSaving = 0;
+  observedSaving = 0;
+  // The table is stored just below the lift positions (see lift_class::lift_class()).
+  // The character before the table tells if the table has been initialised. Tables with one row
+  // per level, as used by earlier versions, had another marker and are therefore not used.
+  EpromStart = EEPROM.length() - (MAX_LEVEL * NUMBER_LENGHT) - 2 - (PARK_ROWS * MAX_LEVEL);
+  if (EEPROM.read(EpromStart - 1) != 0b01010110) {
+    memset(transitions, 0, sizeof(transitions));
+    tableChanged = true;
+    save();
+    EEPROM.update(EpromStart - 1, 0b01010110);
+  }
+  else EEPROM.get(EpromStart, transitions);
+}
+
+
+void parking_class::learn(uint8_t level) {
+  // Called by the request queue for every real request, before the lift starts moving.
+  // Step 1: Update the Markov table. If a count overflows, halve the complete row.
+  if (lastRequest < MAX_LEVEL) {
+    uint8_t i = row(lastRequest);
+    if (transitions[i][level] == 255) {
+      for (uint8_t j = 0; j < MAX_LEVEL; j++) transitions[i][j] /= 2;
+    }
+    transitions[i][level]++;
+    tableChanged = true;
+  }
+  lastRequest = level;
+  // Step 2: If the lift was parked, determine how much time has been saved for this request
+  if ((parkState == PARKED) && (parkedFrom != lift.level)) {
+    observedSaving += (long)tripTime(parkedFrom, level) - (long)tripTime(lift.level, level);
+    if (config.serialLine()) {
+      Serial.print("Parking - observed saving: ");
+      Serial.print(observedSaving);
+      Serial.print("ms, expected saving: ");
+      Serial.print(expectedSaving);
+      Serial.println("ms");
+    }
+  }
+  parkState = IDLE;
+}
+
+
+void parking_class::update() {
+  uint8_t delaySeconds = config.parkDelay();
+  switch (parkState) {
+    case PENDING:
+      // The jog command has been send. Wait till GRBL reports it is jogging. A real request may arrive
+      // before that report; it should not wait. Once GRBL had time to parse the jog command, the jog
+      // is cancelled at once. The move of the request is queued by GRBL after the cancelled jog.
+      if ((requests.depth() > 0) && ((millis() - moveStart) >= PARK_PARSE_TIME)) {
+        jog_object.cancel();
+        cancelled = true;
+        parkState = IDLE;
+      }
+      else if (stepper.state != grbl::IDLE) parkState = MOVING;
+      else if ((millis() - moveStart) >= PARK_TIMEOUT) parkState = IDLE;
+    break;
+    case MOVING:
+      // Real requests take precedence. The jog cancel command stops the lift without an ALARM.
+      if ((requests.depth() > 0) && (!cancelled)) {
+        jog_object.cancel();
+        cancelled = true;
+      }
+      if (stepper.state == grbl::ALARM) parkState = IDLE;   // After a RESET
+      if (stepper.state == grbl::IDLE) {
+        if (cancelled) parkState = IDLE;
+          else parkState = PARKED;
+        idleSince = millis();
+      }
+    break;
+    case IDLE:
+      // Park once the lift has been idle, at a known level and without requests, for long enough
+      if ((!requests.settled()) || (requests.depth() > 0) || (!feedback.liftAtLevel) || macros.running())
+        idleSince = millis();
+      else if ((delaySeconds != 0) && (delaySeconds != 255)) {
+        if ((millis() - idleSince) >= (delaySeconds * 1000UL)) park();
+      }
+    break;
+    case PARKED:
+      // Stay parked till the next real request
+    break;
+  }
+}
+
+
+bool parking_class::busy() {
+  return ((parkState == PENDING) || (parkState == MOVING));
+}
+
+
+//*****************************************************************************************************
+//********************************* Internal Methods for Parking **************************************
+//*****************************************************************************************************
+uint8_t parking_class::row(uint8_t level) {
+  return (level == 0) ? 0 : 1;
+}
+
+
+unsigned long parking_class::tripTime(uint8_t from, uint8_t to) {
+  if (from == to) return 0;
+  float distance = fabs(position[to] - position[from]);
+  return LIFT_START_TIME + (unsigned long)(distance * 1000 / LIFT_SPEED);
+}
+
+
+unsigned long parking_class::expectedTime(uint8_t from) {
+  // The weight of each level is the number of times it followed the row of the last requested level.
+  // If there are not enough samples, the number of times each level has been requested is used.
+  uint16_t weight[MAX_LEVEL];
+  uint16_t total = 0;
+  for (uint8_t j = 0; j < MAX_LEVEL; j++) {
+    weight[j] = (lastRequest < MAX_LEVEL) ? transitions[row(lastRequest)][j] : 0;
+    total += weight[j];
+  }
+  if (total < MIN_SAMPLES) {
+    total = 0;
+    for (uint8_t j = 0; j < MAX_LEVEL; j++) {
+      weight[j] = 0;
+      for (uint8_t i = 0; i < PARK_ROWS; i++) weight[j] += transitions[i][j];
+      total += weight[j];
+    }
+  }
+  if (total == 0) return 0;
+  float sum = 0;
+  for (uint8_t j = 0; j < MAX_LEVEL; j++) sum += (float)weight[j] * tripTime(from, j);
+  return (unsigned long)(sum / total);
+}
+
+
+void parking_class::park() {
+  for (uint8_t i = 0; i < MAX_LEVEL; i++) position[i] = atof(lift.positions[i]);
+  // Determine the level with the lowest expected time for the next trip
+  uint8_t from = lift.level;
+  unsigned long stayTime = expectedTime(from);
+  uint8_t best = from;
+  unsigned long bestTime = stayTime;
+  for (uint8_t p = 0; p < MAX_LEVEL; p++) {
+    unsigned long time = expectedTime(p);
+    if (time < bestTime) {
+      best = p;
+      bestTime = time;
+    }
+  }
+  // The lift is idle, so this is a good moment to write the table to EEPROM
+  save();
+  if ((best != from) && config.irDetect() && !irMasks.free(from, best)) {
+    // A train blocks the passage. Try again once the lift has been idle for ParkDelay seconds
+    idleSince = millis();
+    return;
+  }
+  parkedFrom = from;
+  if (best == from) {
+    parkState = PARKED;
+    return;
+  }
+  parks++;
+  occupancy.leave();
+  expectedSaving += stayTime - bestTime;
+  lift.level = best;
+  GRBL_SERIAL.print("$J=G90 X");
+  GRBL_SERIAL.print(lift.positions[best]);
+  GRBL_SERIAL.print(" Y");
+  GRBL_SERIAL.print(lift.positions[best]);
+  GRBL_SERIAL.print(" F");
+  GRBL_SERIAL.println(PARK_FEEDRATE);
+  cancelled = false;
+  moveStart = millis();
+  parkState = PENDING;
+  if (config.serialLine()) {
+    Serial.print("Park lift at level: ");
+    Serial.print(best);
+    Serial.print(" - expected saving: ");
+    Serial.print(stayTime - bestTime);
+    Serial.println("ms");
+  }
+}
+
+
+void parking_class::save() {
+  // The trips of a simulated scenario (see simbus.h) should not end up in EEPROM
+  #if defined(SIMULATE_SLAVES)
+  tableChanged = false;
+  #endif
+  if (!tableChanged) return;
+  for (uint8_t i = 0; i < PARK_ROWS; i++)
+    for (uint8_t j = 0; j < MAX_LEVEL; j++)
+      EEPROM.update(EpromStart + (i * MAX_LEVEL) + j, transitions[i][j]);
+  tableChanged = false;
+}
@@ -0,0 +1,85 @@
+/*******************************************************************************************************
+File:      parking.h
+Author:    Aiko Pras
+History:   2026/10/18 Version 1.0
+
+
+Purpose:   Predictive pre-positioning ("parking") of the lift while it is idle.
+           After a trip the lift stays at the last level, although the next request usually comes
+           for level 0 or a few other levels that are often used. The parking object learns which
+           levels are requested, and after some idle time moves the lift to the level that minimises
+           the expected time for the next trip.
+
+******************************************************************************************************/
+#pragma once
+#include <Arduino.h>
+#include "levels.h"                  // For MAX_LEVEL
+
+
+/*****************************************************************************************************/
+// The parking class keeps a small Markov table: it counts which level was requested next, after a
+// request for level 0 and after a request for one of the storage levels. Since every storage operation
+// passes level 0, these two rows capture most of the pattern, while the table only grows linearly
+// with the number of levels. The table is stored in EEPROM, just below the lift positions, and is 
+// therefore retained after a restart. To limit EEPROM wear, the table is only written when the lift parks.
+// If a row overflows (255), all counts in that row are halved; older behaviour thus slowly fades.
+//
+// Once the lift is idle for ParkDelay seconds (CV, see cvs.h), the expected time for the next trip is
+// calculated for every possible parking level. That calculation uses the row that belongs to the last
+// requested level, or, if that row has less than MIN_SAMPLES entries, the overall request frequencies.
+// The trip time between two levels is estimated as LIFT_START_TIME plus the distance / LIFT_SPEED.
+// If parking at another level saves time, the lift moves there. The move is performed as GRBL jog
+// command, since such command can immediately be cancelled once a real request arrives. Real requests
+// therefore always take precedence: the parking move is cancelled and the request is dispatched.
+// The lift is not parked while one of the IR beams that matter for the move is blocked (see irmask.h),
+// since a train may be on its way.
+//
+// For analysis purposes, the expected and the observed savings are accumulated. The observed saving
+// is the difference between the trip time from the level before parking, and the trip time from the
+// parking level, for the first real request after parking.
+// Parking is disabled if the ParkDelay CV is 0 (or has never been set).
+#define MIN_SAMPLES       8              // Minimum number of samples before a row is used
+#define LIFT_SPEED        25             // Average lift speed (mm/s), used to estimate trip times
+#define LIFT_START_TIME   1500           // Time (ms) for acceleration, deceleration and feedback
+#define PARK_FEEDRATE     1500           // Speed (mm/min) of the parking move
+#define PARK_TIMEOUT      3000           // Time (ms) the parking move may take to start
+#define PARK_PARSE_TIME   50             // Time (ms) GRBL needs to receive and parse the jog command
+#define PARK_ROWS         2              // Row 0: after level 0. Row 1: after a storage level
+
+class parking_class {
+  public:
+    parking_class();                     // Constructor for initialisation. Reads the table from EEPROM
+    void learn(uint8_t level);           // Called by the request queue for every dispatched request
+    void update();                       // Should be called from main as often as possible
+    bool busy();                         // True while a parking move is pending or in progress
+
+    // Statistics
+    uint16_t parks;                      // Number of parking moves
+    long expectedSaving;                 // Sum of the expected savings (ms)
+    long observedSaving;                 // Sum of the observed savings (ms)
+
+  private:
+    uint8_t transitions[PARK_ROWS][MAX_LEVEL]; // Number of times row [i] was followed by level [j]
+    uint8_t lastRequest;                 // The level that was requested last
+    bool tableChanged;                   // The table in RAM differs from the table in EEPROM
+    uint16_t EpromStart;                 // Start address of the table in EEPROM
+
+    typedef enum {IDLE, PENDING, MOVING, PARKED} parkState_t;
+    parkState_t parkState;
+    unsigned long idleSince;             // Time (millis) since the lift is idle without requests
+    unsigned long moveStart;             // Time (millis) the parking move was send
+    uint8_t parkedFrom;                  // Level the lift was at before it parked
+    bool cancelled;                      // The parking move has been cancelled
+    float position[MAX_LEVEL];           // Lift positions (mm), as numbers instead of strings
+
+    uint8_t row(uint8_t level);          // The row of the table that belongs to a level
+    unsigned long tripTime(uint8_t from, uint8_t to);  // Estimated trip time (ms)
+    unsigned long expectedTime(uint8_t from);          // Expected time (ms) for the next trip
+    void park();                         // Determine the best level and move there
+    void save();                         // Write the table to EEPROM
+};
+
+
+/*****************************************************************************************************/
+// Definition of external objects, which are declared in parking.cpp but used by main
+extern parking_class  parking;
@@ -0,0 +1,256 @@
+/*******************************************************************************************************
+File:      requests.cpp
+Author:    Aiko Pras
+History:   2026/10/18 Version 1.0
+
+
+Purpose:   Implements a queue of pending level requests, received via DCC or the level buttons
+
+******************************************************************************************************/
+#include <Arduino.h>
+#include "requests.h"
+#include "stepper.h"                 // To move the lift and check the stepper state
+#include "rs485.h"                   // To set the button LEDs
+#include "feedback.h"                // To publish the level, if the lift is already there
+#include "support.h"                 // For the LCD display
+#include "parking.h"                 // To learn from requests and check for parking moves
+#include "occupancy.h"               // To track trains moving between the lift and the levels
+#include "irmask.h"                  // To check the IR sensors that matter for the move
+#include "mySettings.h"              // For the default scheduler policy
+#include "config.h"                  // For the Serial_Line and IR_Detect CVs
+
+
+// Instantiate the external object
+request_queue  requests;             // External object, used by main
+
+
+//*****************************************************************************************************
+//****************************** External Methods for the Request Queue *******************************
+//*****************************************************************************************************
+request_queue::request_queue() {
+  #if defined(SCHEDULER_LOOK)
+  policy = LOOK;
+  #else
+  policy = FIFO;
+  #endif
+  count = 0;
+  movingUp = true;
+  starving = false;
+  movePending = false;
+  activeButton = NO_BUTTON;
+  lastLevel = 255;                           // No level has been dispatched yet
+  lastDispatch = 0;
+  maxDepth = 0;
+  dispatched = 0;
+  duplicates = 0;
+  overflows = 0;
+  totalWait = 0;
+  maxWait = 0;
+  totalTravel = 0;
+  starved = 0;
+  irWaits = 0;
+  irWaiting = false;
+}
+
+
+bool request_queue::add(uint8_t level, source_t source, bool strict) {
+  if (level >= MAX_LEVEL) return false;
+  // Step 1: Ignore repetitions of the same request
+  for (uint8_t i = 0; i < count; i++) {
+    if (queue[i].level == level) {
+      duplicates++;
+      return false;
+    }
+  }
+  if ((level == lastLevel) && ((millis() - lastDispatch) < DUPLICATE_WINDOW)) {
+    duplicates++;
+    return false;
+  }
+  // Step 2: Store the request at the end of the queue, provided there is space left
+  if (count == QUEUE_SIZE) {
+    overflows++;
+    return false;
+  }
+  request_t &request = queue[count];
+  request.level = level;
+  request.source = source;
+  request.arrival = millis();
+  request.strict = strict;
+  request.bypassed = 0;
+  count++;
+  if (count > maxDepth) maxDepth = count;
+  return true;
+}
+
+
+void request_queue::update() {
+  // Should be called from main as often as possible, after the stepper state has been analysed.
+  // Step 1: Check if a previously dispatched move has started
+  if (movePending) {
+    if ((stepper.state != grbl::IDLE) || ((millis() - moveStart) >= MOVE_TIMEOUT)) movePending = false;
+    else return;
+  }
+  // Step 2: If the lift has settled, dispatch the request selected by the scheduler policy
+  if ((count > 0) && settled()) {
+    uint8_t next = select();
+    // Step 3: Wait while a beam that matters for leaving the current level or entering the next is
+    // blocked. Beams of tracks that are not aligned with either level are ignored (see irmask.h).
+    if (config.irDetect() && !irMasks.free(lift.level, queue[next].level)) {
+      if (!irWaiting) irWaits++;
+      irWaiting = true;
+      return;
+    }
+    irWaiting = false;
+    request_t request = queue[next];
+    if (starving) starved++;
+    // All older requests are overtaken by this one
+    for (uint8_t i = 0; i < next; i++) queue[i].bypassed++;
+    // Remove the request from the queue, while keeping the order of the other requests
+    for (uint8_t i = next; i < (count - 1); i++) queue[i] = queue[i + 1];
+    count--;
+    dispatch(request);
+  }
+}
+
+
+void request_queue::clear() {
+  count = 0;
+  movePending = false;
+}
+
+
+uint8_t request_queue::depth() {
+  return count;
+}
+
+
+bool request_queue::pending(uint8_t level) {
+  for (uint8_t i = 0; i < count; i++) {
+    if (queue[i].level == level) return true;
+  }
+  return false;
+}
+
+
+void request_queue::arrived() {
+  // Called by main once the steppers are IDLE. A move that has been dispatched but did not yet start
+  // has not arrived
+  if ((activeButton == NO_BUTTON) || movePending) return;
+  btn_cntrl.prepare_LED(LED_OFF, activeButton);
+  activeButton = NO_BUTTON;
+}
+
+
+bool request_queue::settled() {
+  return ((stepper.state == grbl::IDLE) && (!movePending) && (!parking.busy()));
+}
+
+
+//*****************************************************************************************************
+//****************************** Internal Methods for the Request Queue *******************************
+//*****************************************************************************************************
+uint8_t request_queue::select() {
+  // Returns the index of the request that should be served next. Index 0 is the oldest request.
+  // starving is set if the starvation bound selected it; update() counts it once it is dispatched.
+  starving = false;
+  if (policy == FIFO) return 0;
+  // Step 1: Only requests before the first strict request may be considered. If the oldest
+  // request is strict, it must be served now.
+  uint8_t candidates = count;
+  for (uint8_t i = 0; i < count; i++) {
+    if (queue[i].strict) {
+      candidates = i;
+      break;
+    }
+  }
+  if (candidates == 0) return 0;
+  // Step 2: Starvation bound. The oldest request that has been overtaken too often comes first
+  for (uint8_t i = 0; i < candidates; i++) {
+    if (queue[i].bypassed >= MAX_BYPASS) {
+      starving = true;
+      return i;
+    }
+  }
+  // Step 3: LOOK. Serve the nearest level in the current direction of travel. If there is none,
+  // reverse the direction and serve the nearest level in the other direction.
+  float current = atof(lift.currentPosition);
+  for (uint8_t pass = 0; pass < 2; pass++) {
+    uint8_t best = candidates;
+    float bestDistance = 0;
+    for (uint8_t i = 0; i < candidates; i++) {
+      float distance = atof(lift.positions[queue[i].level]) - current;
+      if (!movingUp) distance = -distance;
+      if ((distance >= 0) && ((best == candidates) || (distance < bestDistance))) {
+        best = i;
+        bestDistance = distance;
+      }
+    }
+    if (best < candidates) return best;
+    movingUp = !movingUp;
+  }
+  return 0;
+}
+
+
+void request_queue::dispatch(request_t &request) {
+  unsigned long now = millis();
+  unsigned long wait = now - request.arrival;
+  parking.learn(request.level);
+  occupancy.visit(request.level);
+  float current = atof(lift.currentPosition);
+  float target = atof(lift.positions[request.level]);
+  dispatched++;
+  totalWait += wait;
+  if (wait > maxWait) maxWait = wait;
+  totalTravel += fabs(target - current);
+  if (target != current) movingUp = (target > current);
+  lastLevel = request.level;
+  lastDispatch = now;
+  lift.level = request.level;
+  // For requests from a button, the LED of that button will flash while the lift moves. Once the
+  // lift arrives, arrived() switches it off. btn_cntrl.buttonNumber is only set for the LCD, since
+  // later button events overwrite it.
+  if (request.source == FROM_BUTTON) btn_cntrl.buttonNumber = request.level;
+  // The lift only moves if its position is not yet at the requested level
+  if (strcmp(lift.currentPosition, lift.positions[lift.level])) {
+    lift.move(lift.level);
+    movePending = true;
+    moveStart = now;
+    if (request.source == FROM_BUTTON) {
+      btn_cntrl.prepare_LED(FLASH_SLOW, lift.level);
+      activeButton = lift.level;
+    }
+  }
+  else {
+    feedback.setLiftLevel(lift.level);
+    if (request.source == FROM_BUTTON) btn_cntrl.prepare_LED(LED_OFF, lift.level);
+  }
+  lcd_display.show();
+  if (config.serialLine()) showStatistics(request, wait);
+}
+
+
+void request_queue::showStatistics(request_t &request, unsigned long wait) {
+  Serial.print("Move lift to level: ");
+  Serial.print(request.level);
+  if (request.source == FROM_DCC) Serial.print(" (DCC)");
+    else Serial.print(" (Button)");
+  Serial.print(" - wait: ");
+  Serial.print(wait);
+  Serial.print("ms, mean wait: ");
+  Serial.print(totalWait / dispatched);
+  Serial.print("ms, max wait: ");
+  Serial.print(maxWait);
+  Serial.print("ms, travel: ");
+  Serial.print(totalTravel, 1);
+  Serial.print("mm, queue: ");
+  Serial.print(count);
+  Serial.print(" (max ");
+  Serial.print(maxDepth);
+  Serial.print("), duplicates: ");
+  Serial.print(duplicates);
+  Serial.print(", overflows: ");
+  Serial.print(overflows);
+  Serial.print(", IR waits: ");
+  Serial.println(irWaits);
+}
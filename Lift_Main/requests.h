@@ -0,0 +1,105 @@
+/*******************************************************************************************************
+File:      requests.h
+Author:    Aiko Pras
+History:   2026/10/18 Version 1.0
+
+
+Purpose:   Implements a queue of pending level requests, received via DCC or the level buttons.
+           Requests that arrive while the lift is moving are no longer lost, but stored and
+           dispatched as soon as the lift has arrived at its previous level.
+           The order in which requests are dispatched depends on the scheduler policy.
+
+******************************************************************************************************/
+#pragma once
+#include <Arduino.h>
+
+
+/*****************************************************************************************************/
+// The request_queue class is a bounded FIFO of level requests.
+// DCC command stations repeat each accessory command several times. Such repetitions should not
+// lead to multiple requests for the same level. Therefore a request is ignored if:
+// - the same level is already in the queue, or
+// - the same level was dispatched less than DUPLICATE_WINDOW ms ago.
+// The update() method should be called from main as often as possible. Once the stepper motors
+// are IDLE and the feedback for the previous level has been published, the oldest request will
+// be dispatched, provided the IR beams that matter for leaving the current level and entering the
+// requested level are free (see irmask.h). A dispatch is considered complete once the stepper state
+// is no longer IDLE, or MOVE_TIMEOUT ms have passed (for example because GRBL did not accept the move).
+//
+// Two scheduler policies are supported:
+// - FIFO: requests are dispatched in order of arrival.
+// - LOOK: like an elevator, the lift keeps moving in its current direction and serves the nearest
+//   pending level in that direction. Only if no more requests exist in that direction, the 
+//   direction is reversed. This reduces the total travel distance if several requests are pending.
+//   To avoid starvation, a request that has been overtaken MAX_BYPASS times by younger requests, 
+//   will be served next.
+//   A request can be marked as "strict". A strict request is never overtaken by younger requests,
+//   and will not overtake older requests itself. In other words, it acts as a barrier in the queue. 
+// The default policy is set in mySettings.h (SCHEDULER_LOOK), but may be changed at runtime.
+//
+// For analysis purposes the queue keeps some statistics, such as the maximum queue depth, the 
+// time requests had to wait before being dispatched and the total travel distance. These allow
+// both policies to be compared. If the Serial_Line CV is set, these statistics are shown on the
+// serial monitor after every dispatch.
+#define QUEUE_SIZE         8             // Maximum number of pending requests
+#define DUPLICATE_WINDOW   2000          // Time (ms) in which DCC repetitions are considered duplicates
+#define MOVE_TIMEOUT       3000          // Time (ms) a dispatched move may take to start
+#define MAX_BYPASS         3             // Maximum number of times a request may be overtaken
+#define NO_BUTTON          255           // No button request is being served
+
+class request_queue {
+  public:
+    typedef enum {FROM_DCC, FROM_BUTTON} source_t;
+    typedef enum {FIFO, LOOK} policy_t;
+
+    policy_t policy;                     // The scheduler policy in use
+
+    request_queue();                     // Constructor for initialisation
+    bool add(uint8_t level, source_t source, bool strict = false); // False for duplicates or if full
+    void update();                       // Should be called from main as often as possible
+    void clear();                        // Remove all pending requests (after a RESET)
+    uint8_t depth();                     // Number of pending requests
+    bool pending(uint8_t level);         // True if the level is in the queue
+    bool settled();                      // True if the lift is IDLE and no (parking) move is pending
+    void arrived();                      // Called by main once IDLE: switches off the LED of the request
+
+    // Statistics
+    uint8_t  maxDepth;                   // Maximum number of pending requests seen
+    uint16_t dispatched;                 // Number of requests dispatched
+    uint16_t duplicates;                 // Number of requests ignored as duplicates
+    uint16_t overflows;                  // Number of requests lost, since the queue was full
+    unsigned long totalWait;             // Sum of all wait times (ms), to calculate the mean
+    unsigned long maxWait;               // Longest wait time (ms)
+    float totalTravel;                   // Sum of all travel distances (mm)
+    uint16_t starved;                    // Number of requests served due to the MAX_BYPASS bound
+    uint16_t irWaits;                    // Number of times a dispatch had to wait for the IR beams
+
+  private:
+    struct request_t {
+      uint8_t level;                     // Requested level
+      source_t source;                   // DCC or Button
+      unsigned long arrival;             // Time (millis) the request was added
+      bool strict;                       // Request may not be reordered
+      uint8_t bypassed;                  // Number of times younger requests were served first
+    };
+    request_t queue[QUEUE_SIZE];         // Pending requests, the oldest first
+    uint8_t count;                       // Number of pending requests
+    bool movingUp;                       // Direction of the last move, used by LOOK
+    bool starving;                       // select() returned a request due to the MAX_BYPASS bound
+    bool irWaiting;                      // The next dispatch waits for the IR beams
+
+    bool movePending;                    // A move has been dispatched, but GRBL is still IDLE
+    unsigned long moveStart;             // Time (millis) the last move was dispatched
+    uint8_t activeButton;                // Level button whose request is being served, or NO_BUTTON
+    uint8_t lastLevel;                   // Level of the last dispatched request
+    unsigned long lastDispatch;          // Time (millis) of the last dispatched request
+
+    uint8_t select();                    // Returns the index of the request to be served next
+    void dispatch(request_t &request);   // Move the lift to the requested level
+    void showStatistics(request_t &request, unsigned long wait);
+};
+
+
+/*****************************************************************************************************/
+// Definition of external objects, which are declared in requests.cpp but used by main
+extern request_queue  requests;
@@ -9,19 +9,25 @@ Purpose:   Implements the RS485 communication between this Master controller end
 
 ******************************************************************************************************/
 #include <Arduino.h>
-#include <MoToTimer.h>            // For the MoToTimebase
 #include <AP_RS485_Lift.h>        // My private library wrapper for Nick Gammon's non-blocking RS485 library
 #include <AP_DCC_Decoder_Core.h>  // To get access to cvValues[]
 #include "rs485.h"
 #include "hardware.h"             // Pins for LEDs, DCC input, RS-Bus output etc.
 #include "support.h"              // For toggleLed
+#include "config.h"               // For the IR_Detect CV
+#include "cvs.h"                  // For the poll weight CVs
+#include "stepper.h"              // For the lift level and the GRBL state
+#include "requests.h"             // For the number of pending requests
+#include "macros.h"               // To check if a macro is running
+#include "simbus.h"               // The simulated bus, if SIMULATE_SLAVES is defined
 
 
 // Instantiate some objects. 
-// Since timer_50ms is used in the constructor for talk_to_controllers, it must be instatioated before
-MoToTimebase          timer_50ms;            // Internal timer object for the RS485 bus
-MoToTimer             timer_1000ms;          // Keep alive timer for the IR sensors board         
+#if defined(SIMULATE_SLAVES)
+sim_bus               myRS485(MASTER_ADDR);  // Simulated bus and controllers (see simbus.h)
+#else
 RS485_Lift            myRS485(MASTER_ADDR);  // Internal RS485 object, only used here
+#endif
 talk_to_controllers   controllers;           // External object, used by main
 ir_controller         ir_cntrl;              // External object, used by main
 button_controller     btn_cntrl;             // External object, used by main
@@ -29,64 +35,412 @@ button_controller     btn_cntrl;             // External object, used by main
 
 //*********************************************************************************************************
 talk_to_controllers::talk_to_controllers() {
-  timer_50ms.setBasetime(50);                // 50ms seems reasonable to over the RS485 BUS 
-  timer_1000ms.setTime(1000);                // Start the keep-alive timer for the IR board
-  IrNext = false;                            // Any start value is OK
+  // Fill the slave table: first the button panels, followed by the IR boards
+  const uint8_t panelAddress[2] = {BUTTONS_ADDR, BUTTONS_ADDR_2};
+  const uint8_t boardAddress[2] = {IR_LEDS_ADDR, IR_LEDS_ADDR_2};
+  memset(slaves, 0, sizeof(slaves));
+  for (uint8_t i = 0; i < SLAVES; i++) {
+    if (i < BUTTON_PANELS) {
+      slaves[i].type = BUTTON_PANEL;
+      slaves[i].unit = i;
+      slaves[i].address = panelAddress[i];
+    }
+    else {
+      slaves[i].type = IR_BOARD;
+      slaves[i].unit = i - BUTTON_PANELS;
+      slaves[i].address = boardAddress[i - BUTTON_PANELS];
+    }
+    slaves[i].weightIdle = 1;                // Until loadWeights() is called
+    slaves[i].weightActive = 1;
+  }
+  waiting = false;
+  current = 0;
+  txStart = 0;
+  lastActivity = 0;
+  transactions = 0;
+  lateFrames = 0;
+  busyTime = 0;
+  transactionsPerSecond = 0;
+  utilisation = 0;
+  lastReport = 0;
+  memset(&buttonLatency, 0, sizeof(latency_t));
+  memset(&irLatency, 0, sizeof(latency_t));
+}
+
+
+void talk_to_controllers::loadWeights() {
+  // CVs that have never been written hold 255; in that case the default is used.
+  // A weight of 0 is not allowed, since each controller also needs its keep-alive polls.
+  // All controllers of the same type use the same CVs.
+  for (uint8_t i = 0; i < SLAVES; i++) {
+    bool panel = (slaves[i].type == BUTTON_PANEL);
+    uint8_t idle = cvValues.read(panel ? PollButtonsIdle : PollIrIdle);
+    uint8_t active = cvValues.read(panel ? PollButtonsActive : PollIrActive);
+    if ((idle == 0) || (idle == 255)) idle = POLL_WEIGHT_IDLE;
+    if ((active == 0) || (active == 255)) active = POLL_WEIGHT_ACTIVE;
+    slaves[i].weightIdle = idle;
+    slaves[i].weightActive = active;
+    slaves[i].credit = 0;
+  }
 }
 
 
 void talk_to_controllers::talk485() {
   // Should be called by main as often as possible
-  // Part 1: Poll the IR and Button decoders
-  if (timer_50ms.tick()) {
-    if (IrNext) {
-      // Part 1: Poll the IR LED-Sensors controller
-      if (cvValues.read(IR_Detect)) myRS485.sendPoll(IR_LEDS_ADDR);
-      IrNext = false;
-    }
-    else {
-      // Part 2: Button controller
-      // Check if a BUTTON_LED command is waiting, otherwise send a POLL
-      if (btn_cntrl.ledActionRequested) {
-        // The code below takes 700 microseconds
-        myRS485.setButtonLEDs(btn_cntrl.ledAction, btn_cntrl.ledNumber);
-        btn_cntrl.ledActionRequested = false;
-        if ((btn_cntrl.ledAction == LED_OFF) || (btn_cntrl.ledAction == SINGLE_FLASH) || (btn_cntrl.ledAction == DELAYED_OFF)) {      
-          // If we send a command to (ultimately) switch off the remote LED, turn the local LED off as well
-          digitalWrite(LED_YELLOW, LOW);
-         }
-        }
-      else {
-        // The code below takes 525 microseconds
-        myRS485.sendPoll(BUTTONS_ADDR);
-      }
-    IrNext = true;
-    }
-  }
+  // Part 1: Start a transaction with an IR or Button decoder, if the bus is free
+  if (!waiting && ((micros() - lastActivity) >= RS485_TURNAROUND)) startTransaction();
   // Part 2: Check if / what input we received from the IR and Button decoders
   if (myRS485.input()) { 
+    lastActivity = micros();
     switch (myRS485.command) {
       case IR_FREE: 
       case IR_BUSY: 
-        ir_cntrl.analyse_irled_response();
-        timer_1000ms.restart();      // Restart the IR Board keep-alive timer 
+        // A late reply can not be assigned to a board, thus is dropped
+        if (!accept(IR_BOARD)) break;
+        alive(current);
+        ir_cntrl.analyse_irled_response(slaves[current].unit);
+        if (ir_cntrl.sensorStateChanged) event(current);
+        reply();
       break;
       case BUTTON: 
-        btn_cntrl.analyse_button_response();
+        // The IR boards send their sensor bitmaps as records in BUTTON frames (see AP_RS485_Lift_Ext.h)
+        if (ir_cntrl.validRecord()) {
+          if (!accept(IR_BOARD)) break;
+          alive(current);
+          ir_cntrl.analyse_irled_record(slaves[current].unit);
+          break;
+        }
+        // A reply that arrives after its transaction timed out is dropped. Its events are lost, but the
+        // pressed buttons follow again from the next reply
+        if (!accept(BUTTON_PANEL)) break;
+        if (!btn_cntrl.validFrame()) {
+          slaves[current].counters.malformed++;
+          break;
+        }
+        alive(current);
+        if (btn_cntrl.analyse_button_response(slaves[current].unit)) {
+          if (btn_cntrl.newEvents) event(current);
+          reply();
+        }
       break;
       default:
+        // Only the controller that has been polled may send
+        slaves[current].counters.malformed++;
       break;
     };
   };
-  // Part 3: check the IR-Board keep-alive timer
-  // The purpose is to detect if the connection with the IR-Board got lost
-  if (timer_1000ms.expired()) {
-    if (cvValues.read(IR_Detect)) {
-      digitalWrite(LED_GREEN, LOW);  // Turn the local green LED off
-      ir_cntrl.sensorIsFree = false;
-      ir_cntrl.sensorStateChanged = true;
+  btn_cntrl.update();
+  // Part 3: Check if the controller replied in time
+  // The reply of the button controller consists of several frames, thus the wait restarts with every
+  // frame received. lastActivity is also set once the command has been sent
+  if (waiting) {
+    unsigned long timeout = (slaves[current].type == IR_BOARD) ? TIMEOUT_IR : TIMEOUT_BUTTONS;
+    if ((micros() - lastActivity) >= timeout) endTransaction(true);
+  }
+  // Part 4: check the IR-Board keep-alive times
+  // The purpose is to detect if the connection with an IR-Board got lost
+  for (uint8_t i = BUTTON_PANELS; i < SLAVES; i++) {
+    if (slaves[i].alive && ((millis() - slaves[i].lastReply) >= IR_KEEP_ALIVE)) {
+      slaves[i].alive = false;
+      if (config.irDetect()) {
+        slaves[i].counters.keepAlive++;
+        if (config.serialLine()) {
+          Serial.print("RS485: no reply from ");
+          showName(i);
+          Serial.println();
+        }
+        ir_cntrl.lost(slaves[i].unit);
+      }
+    }
+  }
+  // Part 5: show the statistics
+  if ((millis() - lastReport) >= RS485_REPORT) {
+    lastReport = millis();
+    transactionsPerSecond = (float)transactions * 1000 / RS485_REPORT;
+    utilisation = (float)busyTime / (RS485_REPORT * 10UL);
+    if (config.serialLine() > 1) showStatistics();
+    transactions = 0;
+    busyTime = 0;
+    lateFrames = 0;
+    for (uint8_t i = 0; i < SLAVES; i++) {
+      slaves[i].polls = 0;
+      slaves[i].timeouts = 0;
+      slaves[i].events = 0;
+      slaves[i].totalLatency = 0;
+      slaves[i].maxLatency = 0;
+    }
+  }
+}
+
+
+void talk_to_controllers::event(uint8_t slave) {
+  // The latency is the time since the poll before the one that delivered the event, since the event
+  // may have occured just after that poll. This is the worst case delay for this poll rate.
+  unsigned long latency = millis() - slaves[slave].prevPoll;
+  slaves[slave].events++;
+  slaves[slave].totalLatency += latency;
+  if (latency > slaves[slave].maxLatency) slaves[slave].maxLatency = latency;
+  slaves[slave].lastEvent = millis();
+}
+
+
+void talk_to_controllers::measure(latency_t &latency, unsigned long stamp) {
+  if (stamp == 0) return;                    // The time of the change is not known
+  unsigned long delay = micros() - stamp;
+  latency.count++;
+  latency.total += delay;
+  if (delay > latency.max) latency.max = delay;
+}
+
+
+//*********************************************************************************************************
+void talk_to_controllers::startTransaction() {
+  current = select();
+  slave_t &slave = slaves[current];
+  slave.prevPoll = slave.lastPoll;
+  slave.lastPoll = millis();
+  slave.polls++;
+  slave.counters.polls++;
+  waiting = true;
+  txStart = micros();
+  if (slave.type == IR_BOARD) {
+    // Poll the IR LED-Sensors controller
+    ir_cntrl.poll(slave.unit);
+    myRS485.sendPoll(slave.address);
+  }
+  else {
+    // Button controller
+    // Check if a LED command is waiting, otherwise send a POLL. LED commands can only be sent to the
+    // first panel. The button controller checks its buttons after both commands, and replies to both
+    if (btn_cntrl.ledActionRequested && (slave.address == BUTTONS_ADDR)) btn_cntrl.sendLEDs();
+    else {
+      // The code below takes 525 microseconds
+      myRS485.sendPoll(slave.address);
+    }
+  }
+  lastActivity = micros();
+}
+
+
+void talk_to_controllers::endTransaction(bool timedOut) {
+  // After a timeout, the guard time starts now. After a reply, it started at its reception
+  waiting = false;
+  transactions++;
+  busyTime += micros() - txStart;
+  if (timedOut) {
+    slaves[current].timeouts++;
+    slaves[current].counters.timeouts++;
+    lastActivity = micros();
+  }
+}
+
+
+bool talk_to_controllers::accept(slave_type_t type) {
+  // The frames do not tell the sender. A frame is assigned to the controller of the transaction in
+  // progress, if its command fits the type of that controller. Otherwise it is a late frame, which is
+  // counted for the controller of that type that was polled last
+  if (waiting && (slaves[current].type == type)) return true;
+  uint8_t last = SLAVES;
+  for (uint8_t i = 0; i < SLAVES; i++) {
+    if (slaves[i].type != type) continue;
+    if ((last == SLAVES) || ((millis() - slaves[i].lastPoll) < (millis() - slaves[last].lastPoll))) last = i;
+  }
+  lateFrames++;
+  slaves[last].counters.late++;
+  return false;
+}
+
+
+void talk_to_controllers::reply() {
+  // The reply of the current transaction is complete
+  unsigned long rtt = micros() - txStart;
+  const unsigned long bounds[RTT_BINS - 1] = RTT_BOUNDS;
+  uint8_t bin = 0;
+  while ((bin < (RTT_BINS - 1)) && (rtt > bounds[bin])) bin++;
+  slaves[current].counters.rtt[bin]++;
+  slaves[current].counters.replies++;
+  endTransaction(false);
+}
+
+
+void talk_to_controllers::alive(uint8_t slave) {
+  slaves[slave].lastReply = millis();
+  slaves[slave].alive = true;
+}
+
+
+uint8_t talk_to_controllers::weight(uint8_t slave) {
+  bool active;
+  if (slaves[slave].type == BUTTON_PANEL) {
+    // A panel is active while one of its buttons is held (jogging), or shortly after an event
+    active = ((stepper.state == grbl::JOG) || btn_cntrl.panelPressed[slaves[slave].unit]
+              || ((millis() - slaves[slave].lastEvent) < BUTTONS_ACTIVE_TIME));
+  }
+  else {
+    if (!config.irDetect()) return 0;
+    // The IR sensors matter while a train may move onto or off the lift at level 0, and before the
+    // lift moves, since a move is only allowed if the sensors are free
+    active = ((lift.level == 0) || (requests.depth() > 0) || macros.running());
+  }
+  return (active ? slaves[slave].weightActive : slaves[slave].weightIdle);
+}
+
+
+uint8_t talk_to_controllers::select() {
+  // Weighted round robin: add the weights to the credits, select the controller with the highest
+  // credit and subtract the sum of the weights from its credit. A pending LED command is sent in
+  // the slot of the first button controller, thus moves that controller to the front.
+  int total = 0;
+  uint8_t selected = 0;                      // The first button panel never has weight 0
+  for (uint8_t i = 0; i < SLAVES; i++) {
+    uint8_t w = weight(i);
+    if (w == 0) {
+      slaves[i].credit = 0;
+      continue;
+    }
+    slaves[i].credit += w;
+    total += w;
+    if (slaves[i].credit > slaves[selected].credit) selected = i;
+  }
+  if (btn_cntrl.ledActionRequested) selected = 0;
+  // Whatever the weights, the IR controllers should be polled before their keep-alive time expires
+  if (config.irDetect()) {
+    for (uint8_t i = BUTTON_PANELS; i < SLAVES; i++) {
+      if ((millis() - slaves[i].lastPoll) >= POLL_MAX_INTERVAL) {
+        selected = i;
+        break;
+      }
+    }
+  }
+  slaves[selected].credit -= total;
+  return selected;
+}
+
+
+void talk_to_controllers::showName(uint8_t slave) {
+  if (slaves[slave].type == BUTTON_PANEL) Serial.print("Buttons");
+    else Serial.print("IR");
+  if ((slaves[slave].type == BUTTON_PANEL) ? (BUTTON_PANELS > 1) : (IR_BOARDS > 1)) {
+    Serial.print(" ");
+    Serial.print(slaves[slave].unit + 1);
+  }
+}
+
+
+void talk_to_controllers::showStatistics() {
+  Serial.print("RS485 transactions/s: ");
+  Serial.print(transactionsPerSecond, 1);
+  Serial.print(" - bus utilisation: ");
+  Serial.print(utilisation, 1);
+  Serial.print("% - late frames: ");
+  Serial.println(lateFrames);
+  for (uint8_t i = 0; i < SLAVES; i++) {
+    Serial.print("RS485 ");
+    showName(i);
+    Serial.print(" - polls/s: ");
+    Serial.print((float)slaves[i].polls * 1000 / RS485_REPORT, 1);
+    Serial.print(" - no reply: ");
+    Serial.print(slaves[i].timeouts);
+    Serial.print(" - events: ");
+    Serial.print(slaves[i].events);
+    if (slaves[i].type == BUTTON_PANEL) {
+      Serial.print(" - missed replies: ");
+      Serial.print(btn_cntrl.missedReplies[slaves[i].unit]);
+    }
+    if (slaves[i].events) {
+      Serial.print(" - latency mean: ");
+      Serial.print(slaves[i].totalLatency / slaves[i].events);
+      Serial.print("ms, max: ");
+      Serial.print(slaves[i].maxLatency);
+      Serial.print("ms");
+    }
+    Serial.println();
+  }
+}
+
+
+void talk_to_controllers::command(char c) {
+  switch (c) {
+    case 's': showCounters(); break;
+    case 'r': resetCounters(); Serial.println("RS485 counters reset"); break;
+    default: break;
+  }
+}
+
+
+void talk_to_controllers::resetCounters() {
+  for (uint8_t i = 0; i < SLAVES; i++) memset(&slaves[i].counters, 0, sizeof(counters_t));
+  for (uint8_t i = 0; i < BUTTON_PANELS; i++) btn_cntrl.missedReplies[i] = 0;
+  memset(&buttonLatency, 0, sizeof(latency_t));
+  memset(&irLatency, 0, sizeof(latency_t));
+  ir_cntrl.maxScanAge = 0;
+}
+
+
+void talk_to_controllers::showCounters() {
+  const unsigned long bounds[RTT_BINS - 1] = RTT_BOUNDS;
+  for (uint8_t i = 0; i < SLAVES; i++) {
+    counters_t &counters = slaves[i].counters;
+    Serial.print("RS485 ");
+    showName(i);
+    Serial.print(" (address ");
+    Serial.print(slaves[i].address);
+    Serial.print(") - polls: ");
+    Serial.print(counters.polls);
+    Serial.print(" - replies: ");
+    Serial.print(counters.replies);
+    Serial.print(" - timeouts: ");
+    Serial.print(counters.timeouts);
+    Serial.print(" - late: ");
+    Serial.print(counters.late);
+    Serial.print(" - malformed: ");
+    Serial.print(counters.malformed);
+    if (slaves[i].type == IR_BOARD) {
+      Serial.print(" - keep-alive expired: ");
+      Serial.print(counters.keepAlive);
+    }
+    else {
+      Serial.print(" - replies missed: ");
+      Serial.print(btn_cntrl.missedReplies[slaves[i].unit]);
+    }
+    Serial.println();
+    Serial.print("  RTT (ms)");
+    for (uint8_t j = 0; j < RTT_BINS; j++) {
+      Serial.print(" | ");
+      if (j < (RTT_BINS - 1)) {
+        Serial.print("<=");
+        Serial.print(bounds[j] / 1000.0, 1);
+      }
+      else Serial.print(">20");
+      Serial.print(": ");
+      Serial.print(counters.rtt[j]);
     }
+    Serial.println();
+  }
+  showLatency("Button press -> handled", buttonLatency);
+  showLatency("IR beam -> feedback", irLatency);
+  Serial.print("IR scan age - max: ");
+  Serial.print(ir_cntrl.maxScanAge);
+  Serial.println("ms");
+  #if defined(SIMULATE_SLAVES)
+  myRS485.showStatistics();
+  #endif
+}
+
+
+void talk_to_controllers::showLatency(const char *name, latency_t &latency) {
+  Serial.print("Latency ");
+  Serial.print(name);
+  Serial.print(" - count: ");
+  Serial.print(latency.count);
+  if (latency.count) {
+    Serial.print(" - mean: ");
+    Serial.print((float)latency.total / latency.count / 1000.0, 1);
+    Serial.print("ms, max: ");
+    Serial.print(latency.max / 1000.0, 1);
+    Serial.print("ms");
   }
+  Serial.println();
 }
 
 
@@ -94,22 +448,106 @@ void talk_to_controllers::talk485() {
 ir_controller::ir_controller() {
   sensorIsFree = false;                      // Initial values should be false.
   sensorStateChanged = false;
+  changeTime = 0;
+  maxScanAge = 0;
+  blocked = IR_ALL_BLOCKED;
+  for (uint8_t i = 0; i < IR_BOARDS; i++) {
+    boardBlocked[i] = 0xFFFF;
+    sensors[i] = 0;
+    stamp[i] = 0;
+    scanAge[i] = AGE_UNKNOWN;
+    received[i] = 0;
+  }
+  memset(trackInfo, 0, sizeof(trackInfo));
+  memset(trackSpeed, 0, sizeof(trackSpeed));
+  memset(tracks, 0, sizeof(tracks));
+  memset(passed, 0, sizeof(passed));
 }
 
 
-void ir_controller::analyse_irled_response() { 
-  if ((myRS485.command == IR_FREE) && (!sensorIsFree)) {
-    digitalWrite(LED_GREEN, HIGH);       // Turn the local green LED on
-    sensorIsFree = true;
-    sensorStateChanged = true;
-  };
-  // Changed 2023/01/22
-  // if (myRS485.command == IR_BUSY) {
-  if ((myRS485.command == IR_BUSY) && (sensorIsFree)) {
-    digitalWrite(LED_GREEN, LOW);  // Turn the local green LED off
-    sensorIsFree = false;
-    sensorStateChanged = true;
-  };
+void ir_controller::poll(uint8_t board) {
+  // Records of a reply that did not complete should not be mixed with those of the next reply
+  received[board] = 0;
+  stamp[board] = 0;
+}
+
+
+bool ir_controller::validRecord() {
+  if ((myRS485.action >= REC_SENSORS_LOW) && (myRS485.action <= REC_SCAN_AGE)) return true;
+  return ((myRS485.action >= REC_TRACK_INFO) && (myRS485.action < (REC_TRACK_SPEED + TRACK_RECORDS)));
+}
+
+
+void ir_controller::analyse_irled_record(uint8_t board) {
+  switch (myRS485.action) {
+    case REC_SENSORS_LOW:
+      sensors[board] = (sensors[board] & 0xFF00) | myRS485.value;
+      received[board] |= 0b01;
+    break;
+    case REC_SENSORS_HIGH:
+      sensors[board] = (sensors[board] & 0x00FF) | (myRS485.value << 8);
+      received[board] |= 0b10;
+    break;
+    case REC_SENSORS_AGE:
+      // The age is converted to the time of the change on our own clock
+      if (myRS485.value == AGE_UNKNOWN) stamp[board] = 0;
+        else stamp[board] = micros() - (myRS485.value * 1000UL);
+    break;
+    case REC_SCAN_AGE:
+      scanAge[board] = myRS485.value;
+      received[board] |= 0b100;
+      if (myRS485.value > maxScanAge) maxScanAge = myRS485.value;
+    break;
+    default:
+      analyse_track_record(board);
+    break;
+  }
+}
+
+
+void ir_controller::analyse_track_record(uint8_t board) {
+  // A passage completed if the counter of a track changed. The first record of a track only sets its counter
+  if (myRS485.action >= REC_TRACK_SPEED) {
+    trackSpeed[board][myRS485.action - REC_TRACK_SPEED] = myRS485.value;
+    return;
+  }
+  uint8_t track = myRS485.action - REC_TRACK_INFO;
+  uint8_t mask = (1 << track);
+  if ((tracks[board] & mask) && ((myRS485.value & 0xF0) != (trackInfo[board][track] & 0xF0)))
+    passed[board] |= mask;
+  trackInfo[board][track] = myRS485.value;
+  tracks[board] |= mask;
+}
+
+
+void ir_controller::analyse_irled_response(uint8_t board) { 
+  // Changed 2023/01/22: only a change of state is reported to main
+  // Without a complete bitmap, all sensors are blocked if the board reports busy
+  if ((received[board] & 0b11) == 0b11) boardBlocked[board] = sensors[board];
+    else boardBlocked[board] = (myRS485.command == IR_FREE) ? 0 : 0xFFFF;
+  // A board that no longer scans its sensors can not tell if they are free
+  if ((received[board] & 0b100) && (scanAge[board] > IR_MAX_SCAN_AGE)) boardBlocked[board] = 0xFFFF;
+  received[board] = 0;
+  combine(stamp[board]);
+}
+
+
+void ir_controller::lost(uint8_t board) {
+  boardBlocked[board] = 0xFFFF;
+  combine(0);                                // The change is detected here, not by the board
+}
+
+
+void ir_controller::combine(unsigned long time) {
+  // Each board has its own 16 bits, thus the IR masks can tell the sensors of both boards apart
+  ir_bits_t bits = 0;
+  for (uint8_t i = 0; i < IR_BOARDS; i++) bits |= (ir_bits_t)boardBlocked[i] << (16 * i);
+  if (bits == blocked) return;
+  blocked = bits;
+  changeTime = time;
+  digitalWrite(LED_GREEN, (bits == 0));      // The local green LED is on if the sensors are free
+  sensorIsFree = (bits == 0);
+  sensorStateChanged = true;
 }
 
 
@@ -120,19 +558,145 @@ bool ir_controller::stateChanged() {
 }
 
 
+bool ir_controller::trainPassed(uint8_t &board, uint8_t &track) {
+  for (board = 0; board < IR_BOARDS; board++) {
+    if (!passed[board]) continue;
+    for (track = 0; track < TRACK_RECORDS; track++) {
+      if (!(passed[board] & (1 << track))) continue;
+      passed[board] &= ~(1 << track);
+      return true;
+    }
+  }
+  return false;
+}
+
+
 //*********************************************************************************************************
 // The constructor below initialises the object
 button_controller::button_controller() {
   button_level_flag = false;
   button_up_down_flag = false;
   button_alarm_flag = false;
+  ledActionRequested = false;
+  ledChanged = 0;
+  pressedButtons = 0;
+  newEvents = false;
+  buttonTime = 0;
+  head = 0;
+  count = 0;
+  for (uint8_t i = 0; i < BUTTON_PANELS; i++) {
+    panelPressed[i] = 0;
+    missedReplies[i] = 0;
+    pressedLow[i] = 0;
+    shortPresses[i] = 0;
+    longPresses[i] = 0;
+    sequence[i] = 0;
+    replyReceived[i] = false;
+    lastReply[i] = 0;
+    stamp[i] = 0;
+  }
+  for (uint8_t i = 0; i < PANEL_LEDS; i++) ledActions[i] = LED_OFF;
+}
+
+
+bool button_controller::analyse_button_response(uint8_t panel) {
+  // Short and long press events are collected until the bitmap, which completes the reply, is received.
+  // The events are then queued in the order PRESSED, SHORTPRESS / LONGPRESS and RELEASED.
+  uint8_t data = myRS485.value;
+  switch (myRS485.action) {
+    case SHORTPRESS:
+      if (data < PANEL_LEDS) shortPresses[panel] |= (1 << data);
+    break;
+    case LONGPRESS:
+      if (data < PANEL_LEDS) longPresses[panel] |= (1 << data);
+    break;
+    case REC_SEQUENCE:
+      if (replyReceived[panel]) missedReplies[panel] += (uint8_t)(data - sequence[panel] - 1);
+      sequence[panel] = data;
+    break;
+    case REC_AGE:
+      // The age is converted to the time of the change on our own clock
+      if (data == AGE_UNKNOWN) stamp[panel] = 0;
+        else stamp[panel] = micros() - (data * 1000UL);
+    break;
+    case REC_PRESSED_LOW:
+      pressedLow[panel] = data;
+    break;
+    case REC_PRESSED_HIGH:
+      panelPressed[panel] = pressedLow[panel] | (data << 8);
+      replyReceived[panel] = true;
+      lastReply[panel] = millis();
+      merge(shortPresses[panel], longPresses[panel], stamp[panel]);
+      stamp[panel] = 0;
+      shortPresses[panel] = 0;
+      longPresses[panel] = 0;
+      return true;
+    default:
+    break;
+  }
+  return false;
+}
+
+
+void button_controller::merge(uint16_t shortPress, uint16_t longPress, unsigned long time) {
+  // A button counts as pressed while it is pressed on either panel
+  uint16_t pressed = 0;
+  for (uint8_t i = 0; i < BUTTON_PANELS; i++) pressed |= panelPressed[i];
+  uint16_t down = pressed & ~pressedButtons;
+  uint16_t up = pressedButtons & ~pressed;
+  pressedButtons = pressed;
+  newEvents = (down | up | shortPress | longPress);
+  for (uint8_t i = 0; i < PANEL_LEDS; i++) {
+    uint16_t mask = (1 << i);
+    if (down & mask) push(i, PRESSED, time);
+    if (shortPress & mask) push(i, SHORTPRESS, time);
+    if (longPress & mask) push(i, LONGPRESS, 0);
+    if (up & mask) push(i, RELEASED, time);
+  }
+}
+
+
+bool button_controller::validFrame() {
+  // Events (PRESSED .. RELEASED) or one of the records of AP_RS485_Lift_Ext.h
+  uint8_t action = myRS485.action;
+  return (((action >= PRESSED) && (action <= RELEASED)) ||
+          ((action >= REC_PRESSED_LOW) && (action <= REC_AGE)));
+}
+
+
+void button_controller::update() {
+  // If a button controller stopped replying, none of its buttons can be known to be held
+  for (uint8_t i = 0; i < BUTTON_PANELS; i++) {
+    if (panelPressed[i] && ((millis() - lastReply[i]) >= BUTTON_LINK_TIMEOUT)) {
+      panelPressed[i] = 0;
+      merge(0, 0, 0);
+    }
+  }
+  // Pass the next event to main, once main has handled the previous one
+  if (count && !button_level_flag && !button_up_down_flag && !button_alarm_flag) {
+    dispatch(queue[head]);
+    head = (head + 1) % BUTTON_QUEUE;
+    count--;
+  }
 }
 
 
-void button_controller::analyse_button_response() {
-      buttonNumber = myRS485.value;        // Save which button was pressed / released
-      buttonAction = myRS485.action;       // Was it pressed, long or short, or released?
-      switch (myRS485.value) {             
+void button_controller::push(uint8_t number, uint8_t action, unsigned long time) {
+  // If the queue is full, the event is dropped
+  if (count >= BUTTON_QUEUE) return;
+  queue[(head + count) % BUTTON_QUEUE].number = number;
+  queue[(head + count) % BUTTON_QUEUE].action = action;
+  queue[(head + count) % BUTTON_QUEUE].time = time;
+  count++;
+}
+
+
+void button_controller::dispatch(event_t &event) {
+      uint8_t number = event.number;
+      buttonNumber = number;               // Save which button was pressed / released
+      buttonAction = event.action;         // Was it pressed, long or short, or released?
+      buttonTime = event.time;             // When did it happen on the panel (our clock)?
+      switch (number) {             
         case RESET_BUTTON: 
           button_alarm_flag = true;
           break;
@@ -145,7 +709,7 @@ void button_controller::analyse_button_response() {
           buttonUpOrDown = DOWN;
           break;
         default: // Button 0..10
-          if (myRS485.value <= 10) {
+          if (number <= 10) {
             button_level_flag = true;
           }
           break;
@@ -162,6 +726,7 @@ bool button_controller::level_button_event() {
   if (button_level_flag) {
     result = true;
     button_level_flag = false;
+    controllers.measure(controllers.buttonLatency, buttonTime);
   }
   return result;
 }
@@ -172,6 +737,7 @@ bool button_controller::up_down_button_event() {
   if (button_up_down_flag) {
     result = true;
     button_up_down_flag = false;
+    controllers.measure(controllers.buttonLatency, buttonTime);
   }
   return result;
 }
@@ -182,13 +748,54 @@ bool button_controller::alarm_button_event() {
   if (button_alarm_flag) {
     result = true;
     button_alarm_flag = false;
+    controllers.measure(controllers.buttonLatency, buttonTime);
   }
   return result;
 }
 
 
 void button_controller::prepare_LED(const byte action, const byte number) {
+  // Levels above 13 have no button, and thus no LED
+  if (number >= PANEL_LEDS) return;
   ledActionRequested = true;
-  ledNumber = number;
-  ledAction = action;
+  ledActions[number] = action;
+  ledChanged |= (1 << number);
+}
+
+
+void button_controller::sendLEDs() {
+  // The LED state frame can only be used if all LEDs are either on or off
+  uint8_t count = 0;
+  uint8_t number = 0;
+  bool onOff = true;
+  uint16_t state = 0;
+  for (uint8_t i = 0; i < PANEL_LEDS; i++) {
+    if ((ledActions[i] != LED_OFF) && (ledActions[i] != LED_ON)) onOff = false;
+    if (ledActions[i] == LED_ON) state |= (1 << i);
+    if (!(ledChanged & (1 << i))) continue;
+    if (count++ == 0) number = i;
+  }
+  if (count == 0) {
+    ledActionRequested = false;
+    return;
+  }
+  uint8_t action;
+  if ((count > 1) && onOff) {
+    myRS485.setButtonLEDs(state & 0xFF, LED_STATE | (state >> 8));
+    ledChanged = 0;
+    action = LED_OFF;                        // The Button controller turns its yellow LED off as well
+  }
+  else {
+    // The code below takes 700 microseconds
+    action = ledActions[number];
+    myRS485.setButtonLEDs(action, number);
+    ledChanged &= ~(1 << number);
+    // A single flash ends with the LED off
+    if ((action == SINGLE_FLASH) || (action == DELAYED_OFF)) ledActions[number] = LED_OFF;
+  }
+  ledActionRequested = (ledChanged != 0);
+  if ((action == LED_OFF) || (action == SINGLE_FLASH) || (action == DELAYED_OFF)) {
+    // If we send a command to (ultimately) switch off the remote LED, turn the local LED off as well
+    digitalWrite(LED_YELLOW, LOW);
+  }
 }
@@ -10,40 +10,269 @@ Purpose:   Implements the RS485 communication between this Master controller end
 ******************************************************************************************************/
 #pragma once
 #include <AP_RS485_Lift.h>         // Needed since we use several constants from there in main
+#include <AP_RS485_Lift_Ext.h>     // For the LED state frame, records and the second panel and board
+#include "mySettings.h"            // For the number of button panels and IR boards
 
 
 #define RESET_BUTTON   11
 #define UP_BUTTON      12
 #define DOWN_BUTTON    13
+#define PANEL_LEDS     14         // Number of LEDs on the button panel (one per button)
+
+#if !defined(BUTTON_PANELS)
+  #define BUTTON_PANELS  1
+#endif
+#if !defined(IR_BOARDS)
+  #define IR_BOARDS      1
+#endif
+#if (BUTTON_PANELS < 1) || (BUTTON_PANELS > 2) || (IR_BOARDS < 1) || (IR_BOARDS > 2)
+  #error "BUTTON_PANELS and IR_BOARDS should be 1 or 2"
+#endif
+#if (IR_BOARDS > 1)
+  typedef uint32_t ir_bits_t;     // Bitmap of the sensors of all IR boards, 16 bits per board
+#else
+  typedef uint16_t ir_bits_t;
+#endif
+#define IR_ALL_BLOCKED ((ir_bits_t)0xFFFFFFFF)
 
 
 //****************************************** SEND COMMANDS ********************************************
 // An instance of the talk_to_controllers class should be called from main as often as possible.
-// It sends commands (POLL, BUTTON_LED or IR_REQUEST) to the button and IR-LED controllers
-// To avoid collisions on the RS485 bus, such commands are only send every 50ms
+// It sends commands (POLL, BUTTON_LED or IR_REQUEST) to the button and IR-LED controllers.
+// The bus may hold one or two button panels, and one or two IR boards (see BUTTON_PANELS and IR_BOARDS
+// in mySettings.h). Each controller has an entry in the slave table, which holds its type, address,
+// poll weights and statistics.
+// Earlier versions sent such commands every 50ms, although the controllers reply within a few ms.
+// Now each command starts a transaction, which ends once the reply is received, or once the timeout
+// for that controller expires. The button controller answers every command with a reply that consists
+// of several frames (see below); the transaction ends with the last frame, or once no further frame is
+// received within the timeout. Frames that arrive outside the transaction they belong to are counted
+// as late, and dropped. The next transaction only starts once the bus has been quiet for
+// RS485_TURNAROUND microseconds. This guard also gives the controller time to release the bus.
+//
+// Which controller gets the next transaction is decided by a weighted scheduler. Each controller has
+// an idle and an active weight, stored in CVs (see cvs.h). Every transaction, the weight of each
+// controller is added to its credit; the controller with the highest credit is selected, and the sum
+// of all weights is subtracted from its credit. The share of transactions a controller gets is
+// therefore equal to its weight, divided by the sum of all weights. A controller uses its active
+// weight if:
+// - Buttons: a button of that panel is being held (for example for jogging), or its last button event
+//   was less than BUTTONS_ACTIVE_TIME ms ago.
+// - IR: the lift is at (or moves to) level 0, where trains are loaded, or requests or a macro are
+//   pending, since the IR sensors are checked before the lift moves.
+// Otherwise the idle weight is used. Controllers of the same type share the same CVs. Whatever the
+// weights, each IR controller is polled at least every POLL_MAX_INTERVAL ms, to stay well within its
+// keep-alive time of IR_KEEP_ALIVE ms. If the IR sensors are not used, all transactions go to the
+// button controllers. Since each controller gets its own share, the poll rate of a controller only
+// drops by the share of the added controller, which can be given a low (idle) weight.
+//
+// The frames of the AP_RS485_Lift library do not hold the address of the sender. A reply is therefore
+// assigned to the controller of the transaction in progress, provided its command (or, for records,
+// the type of the record) fits the type of that controller. Frames that arrive outside their transaction
+// are counted as late for the controller of that type that was polled last.
+// For analysis purposes the number of polls, timeouts and the event latency (time between the previous
+// poll and the reply that reported the event) are kept per controller, as well as the number of
+// transactions and the bus utilisation (the share of time a transaction is in progress). If the
+// Serial_Line CV is 2, these are shown every RS485_REPORT ms on the serial monitor.
+//
+// To tune the poll weights and to detect cabling problems, counters are kept per controller since
+// start-up (or the last reset): polls sent, complete replies, timeouts, late frames (received after
+// the timeout), malformed frames (unknown command or record) and the number of times the IR
+// keep-alive timer expired. The round-trip times (from the start of the poll till the reception
+// of the complete reply) are counted in a histogram, with the upper bounds (in us) given by RTT_BOUNDS.
+// These can be shown and reset via the serial monitor, by typing '&' followed by:
+// - 's': show the counters and histograms
+// - 'r': reset the counters and histograms
+// Other characters are passed to GRBL, as before.
+//
+// To measure latencies across the boards, the button and IR controllers add to each reply the age (ms)
+// of their last change (see AP_RS485_Lift_Ext.h). Subtracting the age from the time the record is
+// received gives the time of the change on the clock of this controller; no clock synchronisation is
+// needed, since the drift over at most 254 ms is negligible. The delay between this time and the moment
+// main acts on the change is kept as end-to-end latency:
+// - Buttons: from the press or release till main handles the event (and sends the jog command to GRBL)
+// - IR: from the beam change till the RS-Bus feedback has been sent.
+// These latencies are shown and reset with the counters ('&s' and '&r').
+#define RTT_BINS             9        // The last bin counts all round-trip times above 20ms
+#define RTT_BOUNDS           {1000, 2000, 3000, 5000, 7500, 10000, 15000, 20000}
+#define SLAVES               (BUTTON_PANELS + IR_BOARDS)
+#define IR_KEEP_ALIVE        1000     // Time (ms) without reply after which an IR board is considered lost
+#define BUTTONS_ACTIVE_TIME  2000     // Time (ms) after a button event the buttons remain active
+#define RS485_REPORT         10000    // Time (ms) between two reports on the serial monitor
+#define POLL_WEIGHT_IDLE     1        // Default weights, if the CVs are not set
+#define POLL_WEIGHT_ACTIVE   4
+#define POLL_MAX_INTERVAL    500      // Time (ms) after which the IR controller is always polled
+#define RS485_TURNAROUND     2000     // Time (us) the bus should be quiet before the next transaction
+
+// The timeouts follow from the frame lengths and the baud rate of the AP_RS485_Lift library. On the
+// wire, a frame occupies a start and an end byte, plus two bytes (one per nibble) for each of its
+// RS485_HEADER header bytes, its data bytes (none for POLL, two for all other frames) and its CRC. Each
+// byte takes 10 bits. This matches the measured send times of a POLL (525 us, 12 bytes) and a BUTTON_LED
+// command (700 us, 16 bytes), which also include the switching of the bus driver. The wait for a reply
+// starts once the command has been sent, and restarts with every frame received. A timeout therefore
+// covers the command, the time the controller needs before it replies and a single reply frame. Since
+// the command itself is included, the timeout also holds if the send returns before the frame is out.
+#define RS485_BAUD           250000   // Baud rate of the AP_RS485_Lift library
+#define RS485_HEADER         4        // Header bytes of a frame
+#define RS485_FRAME_TIME(data) (((2 + 2 * (RS485_HEADER + (data) + 1)) * 10 * 1000000UL) / RS485_BAUD)
+#define REPLY_DELAY_BUTTONS  2000     // Time (us) the button controller may need before it replies
+#define REPLY_DELAY_IR       2000     // Time (us) the IR controller may need before it replies. Since it
+                                      // scans its sensors in the background, it replies at once
+#define TIMEOUT_BUTTONS      (RS485_FRAME_TIME(2) + REPLY_DELAY_BUTTONS + RS485_FRAME_TIME(2))
+#define TIMEOUT_IR           (RS485_FRAME_TIME(0) + REPLY_DELAY_IR + RS485_FRAME_TIME(2))
+#define IR_MAX_SCAN_AGE      60       // Scan age (ms) above which the sensors of an IR board are blocked
+
 class talk_to_controllers {
   public:
     talk_to_controllers();            // Constructor for initialisation
     void talk485();                   // Schould be called from the main loop as often as possible
+    void loadWeights();               // Read the weights from the CVs. Called at start-up and after PoM
+    void event(uint8_t slave);        // A controller reported an event
+
+    // Counters, per controller, since start-up or the last reset
+    struct counters_t {
+      unsigned long polls;            // Polls and LED commands sent
+      unsigned long replies;          // Complete replies received within the timeout
+      unsigned long timeouts;         // Polls without (complete) reply
+      unsigned long late;             // Frames received after the timeout
+      unsigned long malformed;        // Frames with an unknown command or record
+      unsigned long keepAlive;        // IR boards: number of times no reply was received for 1000ms
+      unsigned long rtt[RTT_BINS];    // Histogram of the round-trip times
+    };
+
+    // The slave table. The button panels come first, followed by the IR boards
+    typedef enum {BUTTON_PANEL, IR_BOARD} slave_type_t;
+    struct slave_t {
+      slave_type_t type;
+      uint8_t unit;                   // Number of the panel or board (0 or 1)
+      uint8_t address;                // RS485 address
+      uint8_t weightIdle;             // Weight if the controller is idle
+      uint8_t weightActive;           // Weight if the controller is active
+      int credit;                     // Credit of the weighted scheduler
+      unsigned long lastPoll;         // Time (millis) of the last poll
+      unsigned long prevPoll;         // Time (millis) of the poll before the last poll
+      unsigned long lastEvent;        // Time (millis) of the last event
+      unsigned long lastReply;        // Time (millis) of the last reply
+      bool alive;                     // A reply was received within IR_KEEP_ALIVE ms
+      // Statistics since the last report
+      uint16_t polls;                 // Number of polls
+      uint16_t timeouts;              // Number of polls without reply
+      uint16_t events;                // Number of events
+      unsigned long totalLatency;     // Sum of the event latencies (ms)
+      unsigned long maxLatency;       // Maximum event latency (ms)
+      counters_t counters;            // Since start-up or the last reset
+    };
+    slave_t slaves[SLAVES];
+
+    // Statistics of the bus
+    uint16_t lateFrames;              // Frames received outside their transaction since the last report
+    uint16_t transactions;            // Number of transactions since the last report
+    unsigned long busyTime;           // Time (us) transactions were in progress since the last report
+    float transactionsPerSecond;      // Results of the last report period
+    float utilisation;                // Percentage
+
+    // End-to-end latency, from the change on a controller till main acted on it
+    struct latency_t {
+      unsigned long count;            // Number of measurements
+      unsigned long total;            // Sum of the latencies (us), to calculate the mean
+      unsigned long max;              // Maximum latency (us)
+    };
+    latency_t buttonLatency;          // Button pressed or released -> event handled by main
+    latency_t irLatency;              // IR beam changed -> RS-Bus feedback sent
+    void measure(latency_t &latency, unsigned long stamp);  // stamp: time (micros) of the change, 0 if unknown
+
+    void showCounters();              // Show the counters on the serial monitor
+    void resetCounters();
+    void command(char c);             // A command ('s' or 'r') received via the serial monitor
+
   private:
-    bool IrNext;                      // Determines if the next RS485 message goes to IR or Button   
+    bool waiting;                     // A transaction is in progress
+    uint8_t current;                  // The controller of the transaction in progress
+    unsigned long txStart;            // Time (micros) the transaction started
+    unsigned long lastActivity;       // Time (micros) of the last transmission or reception
+    unsigned long lastReport;         // Time (millis) of the last report
+    uint8_t weight(uint8_t slave);    // The current weight of a controller
+    uint8_t select();                 // The controller that gets the next transaction
+    void startTransaction();
+    void endTransaction(bool timedOut);
+    bool accept(slave_type_t type);   // True if the frame belongs to the transaction in progress
+    void reply();                     // The reply of the current transaction is complete
+    void alive(uint8_t slave);        // A frame of this controller has been received
+    void showName(uint8_t slave);
+    void showStatistics();
+    void showLatency(const char *name, latency_t &latency);
 };
 
 
 //************************************ ANALYSE IR-LED INPUT RECEIVED **********************************
+// The IR-LED controller answers each POLL with the bitmap of its blocked sensors, sent as two records,
+// followed by IR_FREE or IR_BUSY (see AP_RS485_Lift_Ext.h). The bitmaps of all boards are combined into
+// one: sensor i of the first board is bit i, sensor i of the second board bit 16 + i. Which of these
+// sensors matter for a level is decided by the IR masks (see irmask.h).
+// REC_SENSORS_AGE tells when the bitmap changed; this time is kept in changeTime.
+// The IR-LED controller scans its sensors continuously, and replies at once with the result of its last
+// scan. REC_SCAN_AGE tells how long ago (ms) that scan completed. If the scan age exceeds IR_MAX_SCAN_AGE,
+// the board apparently no longer scans; its sensors are then considered blocked. The highest scan age is
+// shown and reset with the counters ('&s' and '&r').
+// An IR-LED controller with sensors along a track (see Tracks.h of the IR board) adds per track a record
+// with the speed (cm/s) and a record with the direction of the last passage, a passing flag and a passage
+// counter (see REC_TRACK_INFO). Once a train has passed, the board already reports the sensors of that
+// track free; trainPassed() only tells main about each passage, for example to show it on the Serial
+// Monitor. A passage is detected by a change of the counter, thus a record received twice (for example
+// from a late reply) is not reported twice.
+// If a reply holds no (complete) bitmap, for example from an IR-LED controller with older software, all
+// sensors of that board are considered blocked if it reports IR_BUSY. The sensors of a board that does
+// not reply are all considered blocked.
 class ir_controller {
   public:
     ir_controller();                  // Constructor for initialisation
     bool sensorIsFree;                // True if all IR-receivers receive light from their IR-sender 
-    void analyse_irled_response();    // Called if a RS-485 message is received and sets sensorIsFree
+    ir_bits_t blocked;                // Bitmap of blocked sensors of all IR boards (board 2: bit 16..31)
+    uint16_t boardBlocked[IR_BOARDS]; // The last bitmap reported by each IR board
+    void poll(uint8_t board);         // Called if the board is polled. Drops the records of earlier replies
+    bool validRecord();               // True if the BUTTON frame holds a record of an IR board
+    void analyse_irled_record(uint8_t board);    // Called if a record of this board is received
+    void analyse_irled_response(uint8_t board);  // Called if IR_FREE or IR_BUSY is received
+    void lost(uint8_t board);         // No reply from this board within its keep-alive time
     bool stateChanged();              // Function, called from main
     bool sensorStateChanged;          // Variable (to keep state)
+    unsigned long changeTime;         // Time (micros) the IR board saw the last change, 0 if unknown
+    uint8_t maxScanAge;               // Highest scan age (ms) reported by any board
+    uint8_t trackInfo[IR_BOARDS][TRACK_RECORDS];   // Direction, passing and passage counter per track
+    uint8_t trackSpeed[IR_BOARDS][TRACK_RECORDS];  // Speed (cm/s) of the last passage per track
+    bool trainPassed(uint8_t &board, uint8_t &track); // True if a passage completed since the last call
+
+  private:
+    uint16_t sensors[IR_BOARDS];      // The bitmap of the records, until the reply is complete
+    unsigned long stamp[IR_BOARDS];   // Time (micros) of the change, according to REC_SENSORS_AGE
+    uint8_t scanAge[IR_BOARDS];       // Scan age (ms), according to REC_SCAN_AGE
+    uint8_t received[IR_BOARDS];      // Records received: bit 0 = REC_SENSORS_LOW, bit 1 = REC_SENSORS_HIGH,
+                                      // bit 2 = REC_SCAN_AGE
+    uint8_t tracks[IR_BOARDS];        // Per board a bit for each track whose counter is known
+    uint8_t passed[IR_BOARDS];        // Per board a bit for each track with a passage not yet reported
+    void analyse_track_record(uint8_t board);  // Called for a REC_TRACK_SPEED or REC_TRACK_INFO record
+    void combine(unsigned long time); // Sets blocked and sensorIsFree from boardBlocked[]. time: of the change
 };
 
 
 //************************************ ANALYSE BUTTON INPUT RECEIVED **********************************
 // The button_changed method of a button_controller should be called from main as often as possible.
 // If a button message is received, the buttonNumber and buttonAction provide further information 
+//
+// The button controller answers each POLL and BUTTON_LED command with a reply that holds the bitmap
+// of the buttons that are currently pressed, preceded by the new short and long press events, a
+// sequence number and the age of the last change (see AP_RS485_Lift_Ext.h). The PRESSED and RELEASED
+// events are derived here, by comparing the bitmap with the previous one. Thus a lost frame can not
+// cause a lost RELEASED event (which earlier kept the lift jogging). Gaps in the sequence numbers are
+// counted as missed replies. The age gives the time of the PRESSED, SHORTPRESS and RELEASED events;
+// LONGPRESS events are generated while the button is held, thus their time is unknown.
+// If no complete reply is received for BUTTON_LINK_TIMEOUT ms, all pressed buttons are released.
+// Since a reply may contain several events, events are queued and passed to main one at a time.
+// With two panels the bitmaps are merged: a button counts as pressed while it is pressed on either
+// panel. Since the setButtonLEDs() method of the AP_RS485_Lift library can only address BUTTONS_ADDR,
+// the LED commands are only sent to the first panel.
+#define BUTTON_QUEUE          8       // Maximum number of events waiting for main
+#define BUTTON_LINK_TIMEOUT   500     // Time (ms) without replies before the buttons are released
 class button_controller {
   
   public:
@@ -54,17 +283,34 @@ class button_controller {
     typedef enum {UP, DOWN} up_down_t; // For the UP and DOWN buttons
 
     // Attributes set by prepare_LED, and used by talk_to_controllers for sending the actual LED command
-    bool    ledActionRequested;       // true, if a BUTTON_LED command should be send in the next cycle
-    uint8_t ledNumber;                // Which LED should be modified in the new cycle?
-    uint8_t ledAction;                // LED_OFF, LED_ON, SINGLE_FLASH, FLASH_SLOW, FLASH_FAST, DELAYED_OFF
+    // Each LED has one entry, thus several LED changes may wait for the next transaction. If the same
+    // LED changes again before its command is sent, only the last action is kept. If one LED changed,
+    // a BUTTON_LED command is sent for that LED. If more LEDs changed and all LEDs are either on or
+    // off, a single LED state frame is sent that holds the state of all LEDs (see AP_RS485_Lift_Ext.h).
+    // Otherwise the changed LEDs are sent one per transaction.
+    bool    ledActionRequested;       // true, if a LED command should be send in the next cycle
+    uint8_t ledActions[PANEL_LEDS];   // LED_OFF, LED_ON, SINGLE_FLASH, FLASH_SLOW, FLASH_FAST, DELAYED_OFF
+    uint16_t ledChanged;              // Bitmap of LEDs whose action has not been sent yet
+    void sendLEDs();                  // Called by talk_to_controllers to send the LED command
 
     // Attributes for main regarding a received button command:
     uint8_t buttonNumber;             // Which button was pressed? (0..15)
     uint8_t buttonAction;             // PRESSED, SHORTPRESS, LONGPRESS, RELEASED   
+    unsigned long buttonTime;         // Time (micros) the button changed on the panel, 0 if unknown
     up_down_t buttonUpOrDown;         // For the UP and DOWN buttons  
     
+    // Attributes for the replies of the button controllers
+    uint16_t pressedButtons;          // Bitmap of the buttons that are currently pressed, on any panel
+    uint16_t panelPressed[BUTTON_PANELS]; // Bitmap of the pressed buttons, per panel
+    bool newEvents;                   // The last reply contained (or resulted in) events
+    uint16_t missedReplies[BUTTON_PANELS]; // Number of replies lost, according to the sequence numbers
+
+    // Methods called by talk_to_controllers
+    bool validFrame();                // False if the frame holds an unknown record
+    bool analyse_button_response(uint8_t panel);  // Handles a frame of the reply. True if complete
+    void update();                    // Checks the links, and passes the next event to main
+
     // Methods that should be called by main as often as possible
-    void analyse_button_response();   // Checks if a button command is received and if yes, for which button
     bool level_button_event();        // Manages the button_level_flag, associated with the buttons 0..10
     bool up_down_button_event();      // Manages the button_up_down_flag, associated with the buttons UP and DOWN
     bool alarm_button_event();        // Manages the button_alarm_flag, associated with the ALARM button
@@ -72,11 +318,33 @@ class button_controller {
     
     void prepare_LED(const byte action, const byte number);
                                       // Can be called by the main program, or from this class
-                                      // Sets the private attributes ledActionRequested, ledNumber and ledAction
+                                      // Stores the action in ledActions[] and marks the LED in ledChanged
   private:
-    bool button_level_flag;           // Set by analyse_button_response(), cleared by level_button_event()
-    bool button_up_down_flag;         // Set by analyse_button_response(), cleared by up_down_button_event()
-    bool button_alarm_flag;           // Set by analyse_button_response(), cleared by alarm_button_event()
+    bool button_level_flag;           // Set by dispatch(), cleared by level_button_event()
+    bool button_up_down_flag;         // Set by dispatch(), cleared by up_down_button_event()
+    bool button_alarm_flag;           // Set by dispatch(), cleared by alarm_button_event()
+
+    struct event_t {
+      uint8_t number;
+      uint8_t action;
+      unsigned long time;             // Time (micros) of the change, 0 if unknown
+    };
+    event_t queue[BUTTON_QUEUE];      // Events waiting for main
+    uint8_t head;                     // Index of the oldest event
+    uint8_t count;                    // Number of events in the queue
+    // Per panel
+    uint8_t pressedLow[BUTTON_PANELS];     // First half of the bitmap, until the second half is received
+    uint16_t shortPresses[BUTTON_PANELS];  // Short press events received, until the bitmap is received
+    uint16_t longPresses[BUTTON_PANELS];   // Long press events received, until the bitmap is received
+    uint8_t sequence[BUTTON_PANELS];       // Sequence number of the last reply
+    bool replyReceived[BUTTON_PANELS];     // A complete reply has been received
+    unsigned long lastReply[BUTTON_PANELS]; // Time (millis) the last complete reply was received
+    unsigned long stamp[BUTTON_PANELS];     // Time (micros) of the last change, according to REC_AGE
+
+    void merge(uint16_t shortPress, uint16_t longPress, unsigned long time);  // Derives the events
+                                      // from the merged bitmap
+    void push(uint8_t number, uint8_t action, unsigned long time);
+    void dispatch(event_t &event);    // Sets the flags for main
 
 };
 
@@ -0,0 +1,241 @@
+/*******************************************************************************************************
+File:      simbus.cpp
+Author:    Aiko Pras
+History:   2026/10/18 Version 1.0
+
+
+Purpose:   Simulates the RS485 bus, the button controller(s) and the IR controller(s) on the Main Lift
+           Controller itself
+
+******************************************************************************************************/
+#include <Arduino.h>
+#include "simbus.h"
+#include "config.h"                  // For the Serial_Line CV
+
+#if defined(SIMULATE_SLAVES)
+
+
+// The scenario. Times are in ms since the start of the scenario, and should increase.
+struct sim_step_t {
+  unsigned long at;
+  uint8_t action;
+  uint16_t argument;
+};
+
+const sim_step_t scenario[] = {
+  {  1000, sim_bus::SIM_PRESS,   3},             // Short press: move to level 3
+  {  1150, sim_bus::SIM_RELEASE, 3},
+  {  1300, sim_bus::SIM_PRESS,   5},             // Short press while the lift moves: queued
+  {  1450, sim_bus::SIM_RELEASE, 5},
+  { 15000, sim_bus::SIM_PRESS,   0},             // Back to level 0
+  { 15150, sim_bus::SIM_RELEASE, 0},
+  { 25000, sim_bus::SIM_BLOCK,   0b0011},        // A train passes the first two beams
+  { 25400, sim_bus::SIM_BLOCK,   0b1100},
+  { 27000, sim_bus::SIM_FREE,    0b0011},
+  { 27400, sim_bus::SIM_FREE,    0b1100},
+  { 28000, sim_bus::SIM_PRESS,   UP_BUTTON},     // Jog up for 1.5 seconds
+  { 29500, sim_bus::SIM_RELEASE, UP_BUTTON},
+  { 31000, sim_bus::SIM_PRESS,   DOWN_BUTTON},   // Jog down for 1.5 seconds
+  { 32500, sim_bus::SIM_RELEASE, DOWN_BUTTON},
+  { 40000, sim_bus::SIM_RESTART, 0}
+};
+const uint8_t scenarioSteps = sizeof(scenario) / sizeof(sim_step_t);
+
+
+//*****************************************************************************************************
+//****************************** External Methods for the Simulated Bus *******************************
+//*****************************************************************************************************
+sim_bus::sim_bus(uint8_t address) {
+  // The address of the master is implicit; all replies are sent to the master
+  command = 0;
+  value = 0;
+  action = 0;
+  frames = 0;
+  collisions = 0;
+  runs = 0;
+  head = 0;
+  count = 0;
+  replyEnd = 0;
+  memset(reply, 0, sizeof(reply));
+  memset(panels, 0, sizeof(panels));
+  memset(boards, 0, sizeof(boards));
+  step = 0;
+  scenarioStart = 0;
+  scanTime = 0;
+}
+
+
+bool sim_bus::input() {
+  runScenario();
+  if ((count == 0) || ((long)(micros() - reply[head].end) < 0)) return false;
+  command = reply[head].command;
+  value = reply[head].value;
+  action = reply[head].action;
+  head++;
+  count--;
+  return true;
+}
+
+
+void sim_bus::sendPoll(uint8_t destination) {
+  transmit(destination, false);
+}
+
+
+void sim_bus::setButtonLEDs(uint8_t ledAction, uint8_t number) {
+  // The LEDs are not simulated; the panel answers the command like a poll
+  transmit(BUTTONS_ADDR, true);
+}
+
+
+void sim_bus::showStatistics() {
+  Serial.print("Simulated RS485 bus - frames: ");
+  Serial.print(frames);
+  Serial.print(" - collisions: ");
+  Serial.print(collisions);
+  Serial.print(" - scenario runs: ");
+  Serial.println(runs);
+}
+
+
+//*****************************************************************************************************
+//****************************** Internal Methods for the Simulated Bus *******************************
+//*****************************************************************************************************
+void sim_bus::transmit(uint8_t destination, bool data) {
+  unsigned long now = micros();
+  frames++;
+  // A reply that has not been received completely collides with this frame
+  if (count > 0) {
+    count = 0;
+    collisions++;
+    return;
+  }
+  head = 0;
+  for (uint8_t i = 0; i < SLAVES; i++) {
+    if (controllers.slaves[i].address != destination) continue;
+    if (controllers.slaves[i].type == talk_to_controllers::BUTTON_PANEL) {
+      replyEnd = now + RS485_FRAME_TIME(data ? 2 : 0) + SIM_BUTTON_DELAY;
+      answerPanel(controllers.slaves[i].unit);
+    }
+    else {
+      replyEnd = now + RS485_FRAME_TIME(data ? 2 : 0) + SIM_IR_DELAY;
+      answerBoard(controllers.slaves[i].unit);
+    }
+  }
+}
+
+
+void sim_bus::add(uint8_t cmd, uint8_t frameValue, uint8_t frameAction) {
+  if (count >= SIM_REPLY_FRAMES) return;
+  replyEnd += RS485_FRAME_TIME(2);
+  reply[count].end = replyEnd;
+  reply[count].command = cmd;
+  reply[count].value = frameValue;
+  reply[count].action = frameAction;
+  count++;
+  frames++;
+}
+
+
+uint8_t sim_bus::age(bool changeSeen, unsigned long changeTime) {
+  // Same as age() in the Lift_Buttons and Lift_IR sketches
+  unsigned long time = millis() - changeTime;
+  if (!changeSeen || (time >= AGE_UNKNOWN)) return AGE_UNKNOWN;
+  return time;
+}
+
+
+void sim_bus::answerPanel(uint8_t unit) {
+  // Same reply as the Lift_Buttons sketch. LED commands need no action here
+  panel_t &panel = panels[unit];
+  for (uint8_t i = 0; i < PANEL_LEDS; i++) {
+    if (panel.shortPresses & (1 << i)) add(BUTTON, i, SHORTPRESS);
+    if (panel.longPresses & (1 << i)) add(BUTTON, i, LONGPRESS);
+  }
+  panel.shortPresses = 0;
+  panel.longPresses = 0;
+  add(BUTTON, ++panel.sequence, REC_SEQUENCE);
+  add(BUTTON, age(panel.changeSeen, panel.changeTime), REC_AGE);
+  add(BUTTON, lowByte(panel.pressed), REC_PRESSED_LOW);
+  add(BUTTON, highByte(panel.pressed), REC_PRESSED_HIGH);
+}
+
+
+void sim_bus::answerBoard(uint8_t unit) {
+  // Same reply as the Lift_IR sketch
+  board_t &board = boards[unit];
+  add(BUTTON, lowByte(board.seen), REC_SENSORS_LOW);
+  add(BUTTON, highByte(board.seen), REC_SENSORS_HIGH);
+  add(BUTTON, age(board.changeSeen, board.changeTime), REC_SENSORS_AGE);
+  add(BUTTON, (micros() - scanTime) / 1000, REC_SCAN_AGE);
+  add((board.seen == 0) ? IR_FREE : IR_BUSY, 0, 0);
+}
+
+
+void sim_bus::runScenario() {
+  if (scenarioStart == 0) scenarioStart = millis();
+  for (uint8_t i = 0; i < BUTTON_PANELS; i++) updatePanel(panels[i]);
+  updateBoards();
+  while ((step < scenarioSteps) && ((millis() - scenarioStart) >= scenario[step].at)) {
+    const sim_step_t &current = scenario[step];
+    panel_t &panel = panels[0];
+    board_t &board = boards[0];
+    uint16_t mask = (current.action <= SIM_RELEASE) ? (1 << current.argument) : current.argument;
+    switch (current.action) {
+      case SIM_PRESS:
+        panel.pressed |= mask;
+        panel.pressStart[current.argument] = millis();
+        panel.longSent &= ~mask;
+        panel.changeTime = millis();
+        panel.changeSeen = true;
+      break;
+      case SIM_RELEASE:
+        if (!(panel.longSent & mask)) panel.shortPresses |= mask;
+        panel.pressed &= ~mask;
+        panel.changeTime = millis();
+        panel.changeSeen = true;
+      break;
+      case SIM_BLOCK:
+        board.blocked |= mask;
+      break;
+      case SIM_FREE:
+        board.blocked &= ~mask;
+      break;
+      default:                                // SIM_RESTART
+        runs++;
+        step = 0;
+        scenarioStart = millis();
+        if (config.serialLine()) showStatistics();
+      return;
+    }
+    step++;
+  }
+}
+
+
+void sim_bus::updatePanel(panel_t &panel) {
+  for (uint8_t i = 0; i < PANEL_LEDS; i++) {
+    uint16_t mask = (1 << i);
+    if ((panel.pressed & mask) && !(panel.longSent & mask)
+        && ((millis() - panel.pressStart[i]) >= SIM_LONG_PRESS)) {
+      panel.longSent |= mask;
+      panel.longPresses |= mask;
+    }
+  }
+}
+
+
+void sim_bus::updateBoards() {
+  if ((micros() - scanTime) < SIM_IR_SCAN) return;
+  scanTime = micros();
+  for (uint8_t i = 0; i < IR_BOARDS; i++) {
+    board_t &board = boards[i];
+    if (board.blocked == board.seen) continue;
+    board.seen = board.blocked;
+    board.changeTime = millis();
+    board.changeSeen = true;
+  }
+}
+
+
+#endif
@@ -0,0 +1,125 @@
+/*******************************************************************************************************
+File:      simbus.h
+Author:    Aiko Pras
+History:   2026/10/18 Version 1.0
+
+
+Purpose:   Simulates the RS485 bus, the button controller(s) and the IR controller(s) on the Main Lift
+           Controller itself. Without simulation, the polling of the controllers (see rs485.h) can only
+           be tested with three boards wired together, and button presses or trains passing the IR
+           beams have to be created by hand. Since the timing of such tests differs each time, it is
+           hard to tell if a change of the poll weights or timeouts improved the latencies.
+
+******************************************************************************************************/
+#pragma once
+#include <Arduino.h>
+#include <AP_RS485_Lift.h>           // For the RS485 commands and addresses
+#include <AP_RS485_Lift_Ext.h>       // For the records in the replies
+#include "mySettings.h"              // For SIMULATE_SLAVES
+#include "rs485.h"                   // For the slave table and the button numbers
+
+
+/*****************************************************************************************************/
+// If SIMULATE_SLAVES is defined in mySettings.h, rs485.cpp uses a sim_bus object instead of the
+// RS485_Lift object. The sim_bus object offers the same methods and attributes as far as these are used
+// by the master, thus talk_to_controllers, ir_controller and button_controller run unchanged.
+// The real RS485 bus is not used; the button and IR controllers may remain disconnected.
+//
+// The bus model:
+// - Each frame of the AP_RS485_Lift library carries a command, a value and an action. It occupies the
+//   bus for RS485_FRAME_TIME us, the same time the timeouts of the master are derived from (see rs485.h):
+//   480 us for a POLL and 640 us for all other frames.
+// - A virtual controller starts its reply once the command has been received completely, after its
+//   processing time (SIM_BUTTON_DELAY or SIM_IR_DELAY). The frames of a reply follow each other
+//   without a gap. The master receives a frame once it has been transmitted completely.
+// - If the master transmits while a reply is still underway (for example, after a timeout that is
+//   shorter than the time the controller needs), both collide: the rest of the reply and the command
+//   of the master are lost.
+// The virtual controllers answer as the Lift_Buttons and Lift_IR sketches (see AP_RS485_Lift_Ext.h):
+// the button controller with a BUTTON frame per short or long press, followed by the sequence, age and
+// pressed button records; the IR controller with the sensor and age records, followed by IR_FREE or
+// IR_BUSY. As the real IR controller, the virtual one scans its sensors every SIM_IR_SCAN us, independent
+// of the polls; a change of the beams is only seen, and timestamped, by the next scan. A poll is answered
+// with the result of the last scan, and the age of that scan.
+//
+// A scenario drives the virtual controllers. Each step holds the time (ms since the start of the
+// scenario), an action and an argument: SIM_PRESS and SIM_RELEASE a button number, SIM_BLOCK and
+// SIM_FREE a bitmap of IR sensors. SIM_RESTART starts the scenario again. Buttons are pressed on the
+// first panel and beams are blocked on the first IR board. A press shorter than SIM_LONG_PRESS ms gives
+// a short press event, a longer press a long press event (as MoToButtons in Lift_Buttons).
+// The scenario (see simbus.cpp) presses level buttons, jogs the lift and lets trains pass the IR beams,
+// so the end-to-end latencies and RS485 counters ('&s' on the serial monitor) can be compared between
+// different settings. The number of frames and collisions on the virtual bus is shown as well.
+// The scenario holds no long press of a level button, since main would then store the lift position.
+// The GRBL commands and EEPROM stores are blocked as well (see stepper.h), so the real lift never moves.
+#define SIM_BUTTON_DELAY    200          // Time (us) the button controller needs before it replies
+#define SIM_IR_DELAY        200          // Time (us) the IR controller needs before it replies
+#define SIM_IR_SCAN         20000        // Time (us) between two scans of the IR controller
+#define SIM_LONG_PRESS      3000         // Time (ms) after which a held button gives a long press
+#define SIM_REPLY_FRAMES    16           // Maximum number of frames in a reply
+
+class sim_bus {
+  public:
+    typedef enum {SIM_PRESS, SIM_RELEASE, SIM_BLOCK, SIM_FREE, SIM_RESTART} sim_action_t;
+
+    sim_bus(uint8_t address);            // Constructor for initialisation. Same signature as RS485_Lift
+
+    // The part of the RS485_Lift interface that is used by the master
+    bool input();                        // True if a frame has been received completely
+    uint8_t command;
+    uint8_t value;
+    uint8_t action;
+    void sendPoll(uint8_t destination);
+    void setButtonLEDs(uint8_t ledAction, uint8_t number);
+
+    // Statistics
+    unsigned long frames;                // Frames transmitted by the master and the virtual controllers
+    unsigned long collisions;            // Replies (partly) lost since two transmissions overlapped
+    unsigned long runs;                  // Number of times the scenario has been completed
+    void showStatistics();
+
+  private:
+    struct frame_t {
+      unsigned long end;                 // Time (micros) the frame has been transmitted
+      uint8_t command;
+      uint8_t value;
+      uint8_t action;
+    };
+    frame_t reply[SIM_REPLY_FRAMES];     // Only the addressed controller replies, thus one reply at most
+    uint8_t head;                        // Index of the next frame the master receives
+    uint8_t count;                       // Number of frames in the reply
+    unsigned long replyEnd;              // Time (micros) the last frame of the reply ends
+
+    struct panel_t {
+      uint16_t pressed;                  // Bitmap of the buttons that are pressed
+      unsigned long pressStart[PANEL_LEDS]; // Time (millis) each button was pressed
+      uint16_t longSent;                 // Buttons whose long press has been generated
+      uint16_t shortPresses;             // Events waiting for the next reply
+      uint16_t longPresses;
+      uint8_t sequence;
+      unsigned long changeTime;          // Time (millis) of the last change
+      bool changeSeen;
+    };
+    panel_t panels[BUTTON_PANELS];
+
+    struct board_t {
+      uint16_t blocked;                  // Bitmap of the blocked sensors
+      uint16_t seen;                     // Bitmap found by the last check of the sensors
+      unsigned long changeTime;          // Time (millis) the check found a change
+      bool changeSeen;
+    };
+    board_t boards[IR_BOARDS];
+    unsigned long scanTime;              // Time (micros) the last scan of the IR controllers completed
+
+    uint8_t step;                        // Next step of the scenario
+    unsigned long scenarioStart;         // Time (millis) the scenario started
+
+    void transmit(uint8_t destination, bool data);  // The master sends a frame (data: not a POLL)
+    void add(uint8_t command, uint8_t value, uint8_t action);  // Adds a frame to the reply
+    void answerPanel(uint8_t unit);
+    void answerBoard(uint8_t unit);
+    uint8_t age(bool changeSeen, unsigned long changeTime);  // For the age records
+    void runScenario();                  // Executes the scenario steps that are due
+    void updatePanel(panel_t &panel);    // Detects long presses
+    void updateBoards();                 // Scans the sensors of the IR controllers every SIM_IR_SCAN us
+};
@@ -9,9 +9,9 @@ Purpose:   Implements the communication with the GRBL (stepper motor) controller
 #include <Arduino.h>
 #include <EEPROM.h>
 #include <MoToTimer.h>               // For the MoToTimebase
-#include <AP_DCC_Decoder_Core.h>     // For the Serial_Line CV 
 #include "stepper.h"
 #include "mySettings.h"              // For the default lift positions
+#include "config.h"                  // For the Serial_Line CV
 
 
 // Instantiate the external objects. 
@@ -19,6 +19,9 @@ lift_class            lift;                  // External object, used by main
 grbl                  stepper;               // External object, used by main
 jog_class             jog_object;            // External object, used by main
 reset_class           reset_object;          // External object, used by main
+#if defined(SIMULATE_SLAVES)
+null_sink             grblSink;              // Discards the GRBL commands (see stepper.h)
+#endif
 
 
 //*****************************************************************************************************
@@ -35,18 +38,13 @@ lift_class::lift_class() {
   // Check the character before the lift positions to determine if we are initialised.
   if ((EEPROM.read(EpromStart - 1) != 0b01010101) || (FORCE_EEPROM_WRITE)) {
     // No, we are not initialised . Set default values, to avoid all values being FF (255)
-    strcpy(lift.positions[0], LEVEL00);
-    strcpy(lift.positions[1], LEVEL01);
-    strcpy(lift.positions[2], LEVEL02);
-    strcpy(lift.positions[3], LEVEL03);
-    strcpy(lift.positions[4], LEVEL04);
-    strcpy(lift.positions[5], LEVEL05);
-    strcpy(lift.positions[6], LEVEL06);
-    strcpy(lift.positions[7], LEVEL07);
-    strcpy(lift.positions[8], LEVEL08);
-    strcpy(lift.positions[9], LEVEL09);
-    strcpy(lift.positions[10], LEVEL10);
-    strcpy(lift.positions[11], LEVEL11);
+    // Levels above 11 are LEVEL_DISTANCE mm above the previous level.
+    const char defaults[12][NUMBER_LENGHT] = {LEVEL00, LEVEL01, LEVEL02, LEVEL03, LEVEL04, LEVEL05,
+                                              LEVEL06, LEVEL07, LEVEL08, LEVEL09, LEVEL10, LEVEL11};
+    for (uint8_t i=0; i < MAX_LEVEL; i++) {
+      if (i < 12) strcpy(lift.positions[i], defaults[i]);
+        else dtostrf(atof(lift.positions[i - 1]) + LEVEL_DISTANCE, 1, 3, lift.positions[i]);
+    }
     // Now that we have defaults, store these in the EEPROM
     for (uint8_t i=0; i < MAX_LEVEL; i++) 
       EEPROM.put(EpromLevel[i], lift.positions[i]);
@@ -62,11 +60,11 @@ lift_class::lift_class() {
 
 void lift_class::move(uint8_t level) {
   // To the GRBL controller
-  Serial2.print("G90 X");
-  Serial2.print(positions[level]);
-  Serial2.print(" Y");
-  Serial2.println(positions[level]);
-  if (cvValues.read(Serial_Line)) { 
+  GRBL_SERIAL.print("G90 X");
+  GRBL_SERIAL.print(positions[level]);
+  GRBL_SERIAL.print(" Y");
+  GRBL_SERIAL.println(positions[level]);
+  if (config.serialLine()) { 
     Serial.print("G90 X");
     Serial.print(positions[level]);
     Serial.print(" Y");
@@ -76,7 +74,10 @@ void lift_class::move(uint8_t level) {
 
 
 void lift_class::storePosition(uint8_t i){
+  // While the RS485 bus is simulated the lift does not move, thus its position should not be stored
+  #if !defined(SIMULATE_SLAVES)
   EEPROM.put(EpromLevel[i], currentPosition);
+  #endif
 }
 
 
@@ -85,11 +86,18 @@ void lift_class::storePosition(uint8_t i){
 //*****************************************************************************************************
 // The constructor below initialises the object
 grbl::grbl() {
+  #if defined(GRBL_BINARY_STATUS)
+  query_time.setBasetime(100);               // Binary frames are cheap to parse, so we may poll often
+  #else
   query_time.setBasetime(1000);              // How often we send the Status Report Query (?) 
+  #endif
   state = UNKNOWN;                           // The external state machine, seen by main
   previous_state = UNKNOWN;                  // Internal variable, to detect state changes
   parseState = Skip;                         // The internal state machine. We skip the first line
   clear_number();                            // Make the temporary buffer for the position an empty string
+  frame_index = 0;                           // We are not receiving a binary status frame
+  framesReceived = 0;
+  framesCorrupted = 0;
 }
 
 
@@ -111,7 +119,11 @@ void grbl::query_status() {
   // We use a "write", since this is a bit faster than a "print".
   // We don't need a CR/LF (which would result in an "ok" message), thus "println" is not needed
   if (query_time.tick()) {
-    Serial2.write("?");
+    #if defined(GRBL_BINARY_STATUS)
+    GRBL_SERIAL.write(GRBL_BINARY_QUERY);
+    #else
+    GRBL_SERIAL.write("?");
+    #endif
   }
 }
 
@@ -122,9 +134,15 @@ void grbl::parse_grbl_input() {
   // of the stepper motor. We use an internal state machine to keep track of where we are
   // and once we have determined the state of the GRBL controller and its precise position,
   // we inform the main program.
-  if (Serial2.available()) {
-    char inByte = Serial2.read ();
-    if (cvValues.read(Serial_Line) > 1) Serial.write(inByte);
+  if (GRBL_SERIAL.available()) {
+    char inByte = GRBL_SERIAL.read ();
+    // Binary status frames are handled separately. Since the sync byte can not be part of an ASCII
+    // line, the parse state of the ASCII parser remains valid during reception of the frame.
+    if ((frame_index > 0) || ((uint8_t)inByte == GRBL_FRAME_SYNC)) {
+      add_byte2frame(inByte);
+      return;
+    }
+    if (config.serialLine() > 1) Serial.write(inByte);
     switch (parseState) {
       case Skip:
         // In this state we ignore everything, except the start of a new line
@@ -268,6 +286,51 @@ void grbl::copyNumber2liftposition() {
 }
 
 
+void grbl::add_byte2frame(uint8_t inbyte) {
+  // Adds a byte to the binary status frame. Once the frame is complete, it will be analysed.
+  // The time needed per received byte is constant and small, independent of the frame contents.
+  frame[frame_index] = inbyte;
+  frame_index++;
+  if (frame_index == GRBL_FRAME_LENGTH) {
+    frame_index = 0;
+    analyse_frame();
+  }
+}
+
+
+void grbl::analyse_frame() {
+  // The 8-bit sum of all bytes after the sync byte, including the checksum itself, should be zero.
+  uint8_t checksum = 0;
+  for (uint8_t i = 1; i < GRBL_FRAME_LENGTH; i++) checksum += frame[i];
+  if (checksum != 0) {
+    framesCorrupted++;
+    if (config.serialLine()) Serial.println("GRBL frame checksum error");
+    return;
+  }
+  framesReceived++;
+  // Bytes 2..5 hold the X position in steps (little endian, like the ATMega itself).
+  // The position is converted into the same character format as used in the ASCII status report,
+  // to allow comparison with the lift positions stored in EEPROM.
+  int32_t steps;
+  memcpy(&steps, &frame[2], sizeof(steps));
+  dtostrf(steps / GRBL_STEPS_PER_MM, 1, 3, number);
+  copyNumber2liftposition();
+  plannerBlocksFree = frame[10];
+  rxBufferFree = frame[11];
+  feedRate = frame[12] + (frame[13] << 8);
+  // Byte 1 holds the GRBL system state (see system.h in the GRBL sources).
+  switch (frame[1]) {
+    case 0:   state = IDLE;    break;  // STATE_IDLE
+    case 1:   state = ALARM;   break;  // STATE_ALARM
+    case 4:   state = HOMING;  break;  // STATE_HOMING
+    case 8:   state = RUN;     break;  // STATE_CYCLE
+    case 16:  state = HOLD;    break;  // STATE_HOLD
+    case 32:  state = JOG;     break;  // STATE_JOG
+    default:  state = UNKNOWN; break;  // CHECK_MODE, SAFETY_DOOR, SLEEP
+  }
+}
+
+
 //*****************************************************************************************************
 //******************************* External Methods for the JOG object *********************************
 //*****************************************************************************************************
@@ -280,8 +343,8 @@ void jog_class::start(dir_t dir) {
   jog_medium.setBasetime(4000);     // After 4 seconds the jog speed increases to fast
   jog_fast.setBasetime(8000);       // After 6 seconds the jog speed increases to faster
   direction = dir;                  // Should we move UP or the DOWN?
-  if (direction == UP) {Serial2.println(slow_up); }
-  else {Serial2.println(slow_down); }
+  if (direction == UP) {GRBL_SERIAL.println(slow_up); }
+  else {GRBL_SERIAL.println(slow_down); }
   // The accept_jog_commands flag is used by the Simple Send-Response streaming protocol
   stepper.accept_jog_commands = true;
 }
@@ -297,29 +360,29 @@ void jog_class::update() {
     stepper.accept_jog_commands = false;
     switch (speed) {
       case slow:
-        if (direction == UP) {Serial2.println(slow_up); }
-        else {Serial2.println(slow_down); }
+        if (direction == UP) {GRBL_SERIAL.println(slow_up); }
+        else {GRBL_SERIAL.println(slow_down); }
       break;
       case medium:
-        if (direction == UP) {Serial2.println(medium_up); }
-        else {Serial2.println(medium_down); }
+        if (direction == UP) {GRBL_SERIAL.println(medium_up); }
+        else {GRBL_SERIAL.println(medium_down); }
       break;
       case fast:
-        if (direction == UP) {Serial2.println(fast_up); }
-        else {Serial2.println(fast_down); }
+        if (direction == UP) {GRBL_SERIAL.println(fast_up); }
+        else {GRBL_SERIAL.println(fast_down); }
       break;
       case faster:
-        if (direction == UP) {Serial2.println(faster_up); }
-        else {Serial2.println(faster_down); }
+        if (direction == UP) {GRBL_SERIAL.println(faster_up); }
+        else {GRBL_SERIAL.println(faster_down); }
       break;
     }
-    Serial2.flush();
+    GRBL_SERIAL.flush();
   }
 }
 
 
 void jog_class::cancel() { 
-  Serial2.write(0x85);          // Jog Cancel command
+  GRBL_SERIAL.write(0x85);          // Jog Cancel command
   jog_interval.stop();
   jog_slow.stop();
   jog_medium.stop();
@@ -336,32 +399,32 @@ reset_class::reset_class() {
 
 void reset_class::soft_reset() {                
   // Immediately halts and safely resets Grbl
-  Serial2.write(0x18);   // ^x
+  GRBL_SERIAL.write(0x18);   // ^x
 }
 
 
 void reset_class::unlock() {
   // To unlock after a soft-reset.
-  Serial2.println("$X");
+  GRBL_SERIAL.println("$X");
 }
 
 
 void reset_class::feedhold() {
   // The machine decelerates to a stop and then be suspended
-  Serial2.write("!");
+  GRBL_SERIAL.write("!");
 }
 
 
 void reset_class::resume(){
   // To resume after a feedhold
-  Serial2.write("~");
+  GRBL_SERIAL.write("~");
 }
 
 
 void reset_class::home() {
   // Perform a homing cycle. Avoid new cycles when the old cycle hasn't completed.
 //  if (!homing) {
-    Serial2.println("$H");
+    GRBL_SERIAL.println("$H");
 //    homing = true;          // grbl::state_changed() sets to false once stepper state changed
 //  }
 }
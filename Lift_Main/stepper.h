@@ -12,15 +12,36 @@ Purpose:   Implements the communication with the GRBL (stepper motor) controller
 ******************************************************************************************************/
 #pragma once
 #include <MoToTimer.h>      // For the MoToTimebase
+#include "levels.h"         // For MAX_LEVEL
+#include "mySettings.h"     // For SIMULATE_SLAVES
+
+
+/*****************************************************************************************************/
+// The GRBL controller is connected to Serial2. If the RS485 bus is simulated (see simbus.h), the lift
+// should not move: the GRBL commands are then written to grblSink, which discards them and never
+// replies. The lift thus stays at its level, and its state is not updated.
+#if defined(SIMULATE_SLAVES)
+class null_sink : public Print {
+  public:
+    using Print::write;
+    size_t write(uint8_t) { return 1; }
+    int available() { return 0; }
+    int read() { return -1; }
+    void flush() {}
+};
+extern null_sink grblSink;
+#define GRBL_SERIAL    grblSink
+#else
+#define GRBL_SERIAL    Serial2
+#endif
 
 
 /*****************************************************************************************************/
 // The lift class keeps track of the current position (in mm) of the lift, what positions it can
 // move to, and offers a command to perform the actual move.
-// A lift decoder board has 14 outputs, meaning that, in theory, we may support upto 14 lift levels.
-// However; the feedback messages that indicate which level the lift currently is, have "only" 12 bits
-// available for this. Therefore we "limit" the lift to 12 levels.
-// Level 0 is used for arriving and departing trains. The levels 1..11 can be used to store trains. 
+// The number of lift levels (MAX_LEVEL) is set in mySettings.h; by default the lift has 12 levels.
+// See levels.h for the number of DCC and RS-Bus addresses that follow from this number.
+// Level 0 is used for arriving and departing trains. The other levels can be used to store trains. 
 // The precise position (in mm) for each lift level is stored in a two-dimensional array,
 // called "positions".
 // The GRBL commands needed for moves look like: G90 X123.456 Y123.456.
@@ -28,7 +49,6 @@ Purpose:   Implements the communication with the GRBL (stepper motor) controller
 // defined by NUMBER_LENGHT. Since the lift can move 1000mm, numbers may be up to 4 digits before 
 // the decimal separator (.), and 3 digits behind.
 // The size is therefore 7 digits, a decimal separator (.) and a closing '\0' termination character.
-#define MAX_LEVEL      12                // The number of levels the lift can move to
 #define NUMBER_LENGHT  10                // Each lift positions is stored as char array with this size
 
 class lift_class {
@@ -56,6 +76,15 @@ class lift_class {
 // - characters received from the GRBL controller are immediately parsed,
 // - a GRBL status request (?) is periodically send and
 // - the jog object keeps running.
+// If GRBL_BINARY_STATUS is defined in mySettings.h, the status request is GRBL_BINARY_QUERY instead
+// of '?', and GRBL answers with a fixed size binary frame instead of an ASCII status report.
+// The layout of that frame is described in extras/Board-xxx/04-GRBL-and-steppers/GRBL_config/lift_report.h
+// The frame starts with a sync byte (0xA5) that never occurs in GRBL's ASCII output, thus binary frames
+// and ASCII lines (such as ok and ALARM) can be received over the same serial line.
+#define GRBL_BINARY_QUERY   0x87         // Realtime command that requests a binary status frame 
+#define GRBL_FRAME_SYNC     0xA5         // First byte of a binary status frame
+#define GRBL_FRAME_LENGTH   15           // Including sync byte and checksum
+
 class grbl {
   public:
     // The stepper motor may be in one of the following states
@@ -74,6 +103,15 @@ class grbl {
     // Generic methods
     bool state_changed();                // To check if the lift state has changed 
     bool position_changed();             // For main to check if the lift position has changed
+
+    // Additional information from binary status frames
+    uint8_t plannerBlocksFree;           // Free blocks in the GRBL planner buffer
+    uint8_t rxBufferFree;                // Free bytes in the GRBL serial receive buffer
+    uint16_t feedRate;                   // Current feed rate in mm/min
+    
+    // Statistics for binary status frames
+    uint16_t framesReceived;             // Frames with a correct checksum
+    uint16_t framesCorrupted;            // Frames with a checksum error
     
   private: 
     // Methods
@@ -99,6 +137,12 @@ class grbl {
     void clear_number();                 // Clears the number char array
     void add_char2number(char inbyte);   // Adds a character to number char array
     void copyNumber2liftposition();      // Copy the temporary buffer if the number is complete
+
+    // Buffer to store a binary status frame while it is being received
+    uint8_t frame[GRBL_FRAME_LENGTH];    // Buffer in which the binary frame builds up
+    uint8_t frame_index;                 // 0 if we are not receiving a binary frame
+    void add_byte2frame(uint8_t inbyte); // Adds a byte and analyses the frame once complete
+    void analyse_frame();                // Sets state and lift position from a complete frame
     
     // Needed to inform main that the state or lift position has changed  
     bool positionhasChanged;             // Is cleared after main calls if (position_changed()) 
@@ -16,11 +16,13 @@ Purpose:   All support functions and objects are here
 #include <hd44780.h>          // The default Arduino LCD Library is too slow
 #include <hd44780ioClass/hd44780_pinIO.h>
 #include "support.h"
+#include "config.h"           // For the LCD_Display CV
 
 // Instantiate the objects needed
 hd44780_pinIO lcd(RS, RW, ENABLE, D4, D5, D6, D7);
 display_class lcd_display;    // External object   
 led_class     led;            // External object
+loop_timer_class loop_timer;  // External object
 
 
 //*****************************************************************************************************
@@ -44,6 +46,30 @@ void led_class::toggle(uint8_t nummer) {
 }
 
 
+//*****************************************************************************************************
+//*************************************** The loop timer object ***************************************
+//*****************************************************************************************************
+void loop_timer_class::update() {
+  unsigned long now = micros();
+  unsigned long time = now - lastLoop;
+  lastLoop = now;
+  if ((loops > 0) && (time > maxTime)) maxTime = time;   // The first loop includes the report
+  loops++;
+  if ((millis() - lastReport) >= LOOP_REPORT) {
+    if (config.serialLine() > 1) {
+      Serial.print("Loop time - mean: ");
+      Serial.print((LOOP_REPORT * 1000UL) / loops);
+      Serial.print("us, max: ");
+      Serial.print(maxTime);
+      Serial.println("us");
+    }
+    lastReport = millis();
+    loops = 0;
+    maxTime = 0;
+  }
+}
+
+
 //*****************************************************************************************************
 //***************************************** The display object ****************************************
 //*****************************************************************************************************
@@ -89,7 +115,7 @@ void display_class::show() {
   // per main-loop cycle.
   // Therefore the LCD should preferabley only be used for debugging! 
   // Usage of the LCD display can be enabled / disabled via the CV `LCD_Display`
-  if (cvValues.read(LCD_Display)) {
+  if (config.lcdDisplay()) {
     lcd.clear();                                      // takes 140us
     switch (btn_cntrl.buttonNumber) {
       case 12: lcd.print("UP");    break;
@@ -121,7 +147,7 @@ void display_class::show() {
 
 
 void display_class::homing() {
-  if (cvValues.read(LCD_Display)) {
+  if (config.lcdDisplay()) {
     lcd.clear(); 
     lcd.print("Homing started");             
   }
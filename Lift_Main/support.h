@@ -17,6 +17,22 @@ class led_class {
 };
 
 
+// The loop timer measures how long a single run of the main loop takes. If the Serial_Line CV is 2,
+// the mean and maximum loop time are shown every LOOP_REPORT ms on the serial monitor.
+#define LOOP_REPORT   10000             // Time (ms) between two reports
+
+class loop_timer_class {
+  public:
+    void update();            // Should be called once per main loop
+    unsigned long loops;      // Number of loops since the last report
+    unsigned long maxTime;    // Maximum loop time (us) since the last report
+
+  private:
+    unsigned long lastLoop;   // Time (micros) of the previous call
+    unsigned long lastReport; // Time (millis) of the last report
+};
+
+
 class display_class {
   public:
     void init();              // Initialisation
@@ -28,3 +44,4 @@ class display_class {
 // Definition of external objects, which are declared here but used by main 
 extern display_class   lcd_display;
 extern led_class       led;
+extern loop_timer_class loop_timer;
@@ -82,6 +82,15 @@
 #define CMD_COOLANT_FLOOD_OVR_TOGGLE 0xA0
 #define CMD_COOLANT_MIST_OVR_TOGGLE 0xA1
 
+// Loklift: compact binary status report. If enabled, the realtime command CMD_BINARY_STATUS_REPORT
+// is answered with a fixed size binary frame (see lift_report.h), instead of the ASCII status report
+// that is send after a '?'. The Main Lift Controller parses such frame in constant time, which allows
+// much higher poll rates. Next to enabling this define, lift_report.h and lift_report.c should be
+// copied into the grbl folder, and serial.c and protocol.c should be patched (see lift_report.h).
+// NOTE: The Main Lift Controller should be compiled with GRBL_BINARY_STATUS (see its mySettings.h).
+// #define LIFT_BINARY_STATUS_REPORT // Default disabled. Uncomment to enable.
+#define CMD_BINARY_STATUS_REPORT 0x87   // Not used by standard Grbl v1.1
+
 // If homing is enabled, homing init lock sets Grbl into an alarm state upon power up. This forces
 // the user to perform the homing cycle (or override the locks) before doing anything else. This is
 // mainly a safety feature to remind the user to home, since position is unknown to Grbl.
@@ -0,0 +1,65 @@
+/*
+  lift_report.c - compact binary status report for the Loklift
+  Addition to Grbl v1.1h, maintained in the Lift_Vitrine repository
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+*/
+
+#include "grbl.h"
+
+#ifdef LIFT_BINARY_STATUS_REPORT
+
+volatile uint8_t lift_rt_exec = false;
+
+
+// Writes a single byte and adds it to the running checksum.
+static void lift_write_byte(uint8_t data, uint8_t *checksum)
+{
+  serial_write(data);
+  *checksum += data;
+}
+
+
+static void lift_write_int32(int32_t value, uint8_t *checksum)
+{
+  uint8_t idx;
+  for (idx=0; idx<4; idx++) {
+    lift_write_byte((uint8_t)(value & 0xFF), checksum);
+    value >>= 8;
+  }
+}
+
+
+void lift_report_binary_status()
+{
+  // Take a consistent copy of the position; the stepper ISR may update sys_position meanwhile.
+  int32_t current_position[N_AXIS];
+  uint8_t sreg = SREG;
+  cli();
+  memcpy(current_position,sys_position,sizeof(sys_position));
+  SREG = sreg;
+
+  float rate = st_get_realtime_rate();
+  uint16_t feed = (rate > 65535.0) ? 65535 : (uint16_t)rate;
+
+  uint8_t checksum = 0;
+  serial_write(LIFT_FRAME_SYNC);
+  lift_write_byte(sys.state, &checksum);
+  lift_write_int32(current_position[X_AXIS], &checksum);
+  lift_write_int32(current_position[Y_AXIS], &checksum);
+  lift_write_byte(plan_get_block_buffer_available(), &checksum);
+  lift_write_byte(serial_get_rx_buffer_available(), &checksum);
+  lift_write_byte((uint8_t)(feed & 0xFF), &checksum);
+  lift_write_byte((uint8_t)(feed >> 8), &checksum);
+  serial_write((uint8_t)(-checksum));
+}
+
+#endif
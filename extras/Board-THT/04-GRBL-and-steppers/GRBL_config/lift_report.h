@@ -0,0 +1,57 @@
+/*
+  lift_report.h - compact binary status report for the Loklift
+  Addition to Grbl v1.1h, maintained in the Lift_Vitrine repository
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+*/
+
+// The standard Grbl status report is a human readable ASCII line, such as:
+//   <Idle|MPos:100.000,100.000,0.000|FS:0,0>
+// The Main Lift Controller only needs the state and the X position, but has to parse every character.
+// If LIFT_BINARY_STATUS_REPORT is defined in config.h, the realtime command CMD_BINARY_STATUS_REPORT
+// is answered with the following fixed size frame (multi-byte values are little endian):
+//
+//   Byte  0     : LIFT_FRAME_SYNC (0xA5). Never part of Grbl's ASCII output
+//   Byte  1     : sys.state (STATE_IDLE, STATE_ALARM, STATE_CYCLE, ... see system.h)
+//   Byte  2..5  : X machine position in steps (int32_t)
+//   Byte  6..9  : Y machine position in steps (int32_t)
+//   Byte 10     : Number of free blocks in the planner buffer
+//   Byte 11     : Number of free bytes in the serial RX buffer
+//   Byte 12..13 : Current feed rate in mm/min (uint16_t)
+//   Byte 14     : Checksum. The 8-bit sum of bytes 1..14 equals zero
+//
+// Installation (next to enabling LIFT_BINARY_STATUS_REPORT in config.h):
+// 1) Copy lift_report.h and lift_report.c into the grbl folder and add to grbl.h, below the other
+//    includes:
+//      #include "lift_report.h"
+// 2) serial.c, ISR(SERIAL_RX), in the switch for the extended ASCII realtime commands, add:
+//      #ifdef LIFT_BINARY_STATUS_REPORT
+//        case CMD_BINARY_STATUS_REPORT: lift_rt_exec = true; break;
+//      #endif
+// 3) protocol.c, protocol_exec_rt_system(), directly after the EXEC_STATUS_REPORT check, add:
+//      #ifdef LIFT_BINARY_STATUS_REPORT
+//        if (lift_rt_exec) { lift_rt_exec = false; lift_report_binary_status(); }
+//      #endif
+
+#ifndef lift_report_h
+#define lift_report_h
+
+#define LIFT_FRAME_SYNC   0xA5
+#define LIFT_FRAME_LENGTH 15
+
+// Set by the serial RX ISR, cleared by protocol_exec_rt_system(). A separate flag is used, since
+// all eight bits of sys_rt_exec_state are already taken by Grbl itself.
+extern volatile uint8_t lift_rt_exec;
+
+// Sends the binary status frame described above.
+void lift_report_binary_status();
+
+#endif
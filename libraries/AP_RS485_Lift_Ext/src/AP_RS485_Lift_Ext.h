@@ -0,0 +1,105 @@
+/*******************************************************************************************************
+File:      AP_RS485_Lift_Ext.h
+Author:    Aiko Pras
+History:   2026/10/19 Version 1.0
+           2026/10/19 Version 1.1 - Scan age record of the IR-LED controller
+           2026/10/19 Version 1.2 - Track records of the IR-LED controller
+
+
+Purpose:   Extensions of the RS485 protocol between the Main, Button and IR-LED controllers.
+           The frames, addresses and commands are those of the AP_RS485_Lift library; this file only
+           gives a new meaning to values that the library leaves unused. No new frame formats are
+           introduced, thus the library itself remains unchanged.
+
+           This library should be installed next to the AP_RS485_Lift library, and is needed by all
+           three sketches.
+
+******************************************************************************************************/
+#pragma once
+#include <AP_RS485_Lift.h>
+
+
+//********************************************** ADDRESSES ********************************************
+// Addresses of a second button panel and a second IR board. MASTER_ADDR, BUTTONS_ADDR and IR_LEDS_ADDR
+// are defined by the AP_RS485_Lift library.
+#ifndef BUTTONS_ADDR_2
+#define BUTTONS_ADDR_2      3
+#define IR_LEDS_ADDR_2      4
+#endif
+
+
+//******************************************** LED STATE FRAME ****************************************
+// A BUTTON_LED command carries a LED number (0..13) and an action (LED_OFF, LED_ON, ...).
+// If the LED number is LED_STATE or higher, the command sets the on/off state of all LEDs in one
+// frame: bits 0..5 of the number hold LEDs 8..13, the action holds LEDs 0..7 (LED 0 in bit 0).
+// LEDs whose bit is set are switched on, all others are switched off.
+// The Main controller sends these with setButtonLEDs(lowBits, LED_STATE | highBits).
+#ifndef LED_STATE
+#define LED_STATE           0x80
+#endif
+
+
+//******************************************** BUTTON RECORDS *****************************************
+// A BUTTON frame carries a button number (the value) and an action (PRESSED, SHORTPRESS, ...).
+// If the action is REC_PRESSED_LOW or higher, the frame is a record: the action gives the type of the
+// record, the value holds one data byte. The Button controller answers every frame addressed to it
+// with the following frames, sent back-to-back:
+// - a BUTTON frame for every new SHORTPRESS or LONGPRESS event
+// - REC_SEQUENCE:     sequence number of this reply, incremented for every reply
+// - REC_AGE:          time (ms) since the buttons that are pressed last changed (see below)
+// - REC_PRESSED_LOW:  bitmap of the buttons 0..7 that are currently pressed (button 0 in bit 0)
+// - REC_PRESSED_HIGH: bitmap of the pressed buttons 8..13. This is always the last frame of a reply.
+// The Buttons controller sends these with sendButtons(type, data).
+#ifndef REC_PRESSED_LOW
+#define REC_PRESSED_LOW     0x10
+#define REC_PRESSED_HIGH    0x11
+#define REC_SEQUENCE        0x12
+#define REC_AGE             0x13
+#endif
+
+
+//********************************************** IR RECORDS *******************************************
+// The IR-LED controller uses the same records, with types of its own. It answers every POLL with:
+// - REC_SENSORS_LOW:  bitmap of the sensors 0..7 whose beam is blocked (sensor 0 in bit 0)
+// - REC_SENSORS_HIGH: bitmap of the blocked sensors 8..15
+// - REC_SENSORS_AGE:  time (ms) since the bitmap last changed (see below)
+// - REC_SCAN_AGE:     time (ms) since the last scan of the sensors completed. The IR-LED controller
+//                     scans continuously, and replies with the result of its last scan
+// - IR_FREE or IR_BUSY, as before. This is always the last frame of the reply.
+// Only connected sensors are reported. The IR-LED controller sends the records with sendButtons(type,
+// data); the Main controller tells them from button frames by their type.
+#ifndef REC_SENSORS_LOW
+#define REC_SENSORS_LOW     0x20
+#define REC_SENSORS_HIGH    0x21
+#define REC_SENSORS_AGE     0x22
+#endif
+#ifndef REC_SCAN_AGE
+#define REC_SCAN_AGE        0x23
+#endif
+
+
+//********************************************* TRACK RECORDS *****************************************
+// An IR-LED controller with sensors along a track (see Tracks.h of the Lift_IR sketch) adds two records
+// per track to its reply, before IR_FREE or IR_BUSY. The type holds the track number (0..7):
+// - REC_TRACK_SPEED + track: speed (cm/s, max 255) of the last train that passed, 0 if unknown
+// - REC_TRACK_INFO + track:  bits 0..1 the direction of the last passage (1 = into the lift, 2 = out of
+//                            the lift, 0 = unknown), bit 2 set if a train is passing, bits 4..7 a passage
+//                            counter (modulo 16)
+// The speed is sent first, thus once the counter changed the speed of that passage is known as well.
+#ifndef REC_TRACK_INFO
+#define REC_TRACK_INFO      0x30
+#define REC_TRACK_SPEED     0x38
+#define TRACK_RECORDS       8
+#endif
+
+
+//********************************************** AGE RECORDS ******************************************
+// The controllers do not share a clock. Instead, REC_AGE and REC_SENSORS_AGE tell how long ago (in ms,
+// on the clock of the controller) the last change happened, at the moment the record is sent. The Main
+// controller subtracts this age from the time the record is received, which gives the time of the
+// change on its own clock. Since the age is short, the drift between both clocks does not matter.
+// AGE_UNKNOWN is sent if no change has been seen yet, or if the change is older than 254 ms. The same
+// holds for REC_SCAN_AGE: AGE_UNKNOWN if no scan has completed yet, or the last one is too old.
+#ifndef AGE_UNKNOWN
+#define AGE_UNKNOWN         255
+#endif